@@ -0,0 +1,199 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "dvb-arena.h"
+#include <string.h> /* memset */
+
+/**
+ * SECTION:dvb-arena
+ * @short_description: a block allocator for decoder state of one epoch
+ * @stability: Private
+ *
+ * The regions, objects, CLUTs and displays of a #DvbSub only live until the
+ * next mode change, when the decoder state is reset as a whole. The
+ * #DvbArena allocates them from a few large blocks instead of one by one,
+ * and dvb_arena_reset() gives all of them back in one step, rather than
+ * walking every structure to free it.
+ */
+
+/* Allocation granularity, enough for any of the structures kept in it */
+#define DVB_ARENA_ALIGN 8
+#define DVB_ARENA_ROUND(size) (((size) + DVB_ARENA_ALIGN - 1) & ~(gsize) (DVB_ARENA_ALIGN - 1))
+
+struct _DvbArenaBlock
+{
+	DvbArenaBlock *next;
+	gsize size;
+	/* Keeps the data following the header aligned */
+	guint64 data[1];
+};
+
+#define DVB_ARENA_BLOCK_HEADER_SIZE G_STRUCT_OFFSET (DvbArenaBlock, data)
+
+/**
+ * dvb_arena_init:
+ * @arena: the #DvbArena to initialize
+ *
+ * Initializes @arena to be empty. Blocks are allocated on demand.
+ */
+void
+dvb_arena_init (DvbArena *arena)
+{
+	memset (arena, 0, sizeof (DvbArena));
+}
+
+static DvbArenaBlock *
+dvb_arena_add_block (DvbArena *arena, gsize size)
+{
+	DvbArenaBlock *block;
+
+	block = g_malloc (DVB_ARENA_BLOCK_HEADER_SIZE + size);
+	block->size = size;
+	block->next = arena->blocks;
+	arena->blocks = block;
+
+	return block;
+}
+
+/**
+ * dvb_arena_alloc0:
+ * @arena: a #DvbArena
+ * @size: the number of bytes to allocate
+ *
+ * Allocates @size bytes of zeroed memory from @arena. Requests larger than
+ * a block get a block of their own.
+ *
+ * Returns: the allocated memory, valid until the next dvb_arena_reset()
+ */
+gpointer
+dvb_arena_alloc0 (DvbArena *arena, gsize size)
+{
+	DvbArenaBlock *block;
+	gpointer *free_list;
+	gpointer mem;
+
+	size = DVB_ARENA_ROUND (MAX (size, sizeof (gpointer)));
+
+	if (size <= DVB_ARENA_MAX_RECYCLED_SIZE) {
+		free_list = &arena->free_lists[size / DVB_ARENA_ALIGN - 1];
+		if (*free_list) {
+			mem = *free_list;
+			*free_list = *(gpointer *) mem;
+			return memset (mem, 0, size);
+		}
+	}
+
+	if (size > DVB_ARENA_BLOCK_SIZE / 4) {
+		/* Keep the current block for the small allocations that follow */
+		block = dvb_arena_add_block (arena, size);
+		if (arena->blocks->next) {
+			arena->blocks = block->next;
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		}
+		return memset (block->data, 0, size);
+	}
+
+	if (arena->pos + size > arena->end) {
+		block = dvb_arena_add_block (arena, DVB_ARENA_BLOCK_SIZE);
+		arena->pos = (guint8 *) block->data;
+		arena->end = arena->pos + DVB_ARENA_BLOCK_SIZE;
+	}
+
+	mem = arena->pos;
+	arena->pos += size;
+
+	return memset (mem, 0, size);
+}
+
+/**
+ * dvb_arena_free:
+ * @arena: a #DvbArena
+ * @size: the size @mem was allocated with
+ * @mem: memory allocated from @arena
+ *
+ * Returns @mem to @arena before the next reset, to be reused by an
+ * allocation of the same size. Other sizes stay allocated until the reset.
+ */
+void
+dvb_arena_free (DvbArena *arena, gsize size, gpointer mem)
+{
+	gpointer *free_list;
+
+	if (mem == NULL)
+		return;
+
+	size = DVB_ARENA_ROUND (MAX (size, sizeof (gpointer)));
+	if (size > DVB_ARENA_MAX_RECYCLED_SIZE)
+		return;
+
+	free_list = &arena->free_lists[size / DVB_ARENA_ALIGN - 1];
+	*(gpointer *) mem = *free_list;
+	*free_list = mem;
+}
+
+/**
+ * dvb_arena_reset:
+ * @arena: a #DvbArena
+ *
+ * Releases all memory allocated from @arena at once. The most recent
+ * block is kept for the allocations following the reset.
+ */
+void
+dvb_arena_reset (DvbArena *arena)
+{
+	DvbArenaBlock *block, *keep = NULL;
+
+	while (arena->blocks) {
+		block = arena->blocks;
+		arena->blocks = block->next;
+
+		if (!keep && block->size == DVB_ARENA_BLOCK_SIZE)
+			keep = block;
+		else
+			g_free (block);
+	}
+
+	memset (arena->free_lists, 0, sizeof (arena->free_lists));
+
+	if (keep) {
+		keep->next = NULL;
+		arena->blocks = keep;
+		arena->pos = (guint8 *) keep->data;
+		arena->end = arena->pos + DVB_ARENA_BLOCK_SIZE;
+	} else {
+		arena->pos = arena->end = NULL;
+	}
+}
+
+/**
+ * dvb_arena_clear:
+ * @arena: a #DvbArena
+ *
+ * Frees all blocks of @arena.
+ */
+void
+dvb_arena_clear (DvbArena *arena)
+{
+	dvb_arena_reset (arena);
+	g_free (arena->blocks);
+	arena->blocks = NULL;
+	arena->pos = arena->end = NULL;
+}
@@ -0,0 +1,65 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DVB_ARENA_H_
+#define _DVB_ARENA_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Size of the blocks the arena carves its allocations from */
+#define DVB_ARENA_BLOCK_SIZE (16 * 1024)
+
+/* Allocations up to this size are recycled through free lists */
+#define DVB_ARENA_MAX_RECYCLED_SIZE 2048
+
+typedef struct _DvbArenaBlock DvbArenaBlock;
+
+/**
+ * DvbArena:
+ *
+ * A bump allocator for small structures sharing a common lifetime. Memory
+ * is carved sequentially from large blocks and all of it is released at
+ * once with dvb_arena_reset(). Structures freed earlier with
+ * dvb_arena_free() are kept on a free list per size and handed out again
+ * by the next allocation of the same size.
+ */
+typedef struct _DvbArena
+{
+	DvbArenaBlock *blocks;
+	guint8 *pos;
+	guint8 *end;
+
+	gpointer free_lists[DVB_ARENA_MAX_RECYCLED_SIZE / 8];
+} DvbArena;
+
+void      dvb_arena_init   (DvbArena *arena);
+gpointer  dvb_arena_alloc0 (DvbArena *arena, gsize size);
+void      dvb_arena_free   (DvbArena *arena, gsize size, gpointer mem);
+void      dvb_arena_reset  (DvbArena *arena);
+void      dvb_arena_clear  (DvbArena *arena);
+
+#define dvb_arena_new0(arena, type)        ((type *) dvb_arena_alloc0 ((arena), sizeof (type)))
+#define dvb_arena_delete(arena, type, mem) dvb_arena_free ((arena), sizeof (type), (mem))
+
+G_END_DECLS
+
+#endif /* _DVB_ARENA_H_ */
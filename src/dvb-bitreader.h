@@ -0,0 +1,134 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DVB_BIT_READER_H_
+#define _DVB_BIT_READER_H_
+
+#include <glib.h>
+#include <string.h> /* memcpy */
+
+G_BEGIN_DECLS
+
+/**
+ * SECTION:dvb-bitreader
+ * @short_description: inline MSB-first bit reader for pixel data
+ * @stability: Private
+ *
+ * The #DvbBitReader reads the variable length codes of pixel-data sub-blocks.
+ * Unread bits are kept left aligned in a 64-bit cache word, so that reading a
+ * field is a shift and a mask. The cache is refilled with a single unaligned
+ * 8 byte load while at least 8 bytes are left, or byte by byte near the end,
+ * so there is just one bounds check per refill and the data is never read
+ * past its end. Reads beyond the end of the data return zero bits.
+ */
+
+/**
+ * DvbBitReader:
+ *
+ * The state of a bit reader over a memory block. All fields are private.
+ */
+typedef struct _DvbBitReader
+{
+	const guint8 *start;
+	const guint8 *ptr;  /* next byte not yet accounted for in bits */
+	const guint8 *end;
+	guint64 cache;      /* unread bits, left aligned; zero below the valid ones */
+	gint bits;          /* valid bits in cache, negative once read past the end */
+} DvbBitReader;
+
+/* Largest amount of bits dvb_bit_reader_get_bits() and _peek_bits() handle */
+#define DVB_BIT_READER_MAX_BITS 32
+
+static inline void
+dvb_bit_reader_init (DvbBitReader *reader, const guint8 *data, gint len)
+{
+	reader->start = reader->ptr = data;
+	reader->end = data + len;
+	reader->cache = 0;
+	reader->bits = 0;
+}
+
+/* Tops the cache up to at least 56 bits, or to all of the remaining data */
+static inline void
+dvb_bit_reader_refill (DvbBitReader *reader)
+{
+	guint64 word;
+
+	if (G_LIKELY (reader->end - reader->ptr >= 8)) {
+		memcpy (&word, reader->ptr, 8);
+		/* Bytes that only partially fit are loaded again by the next refill,
+		 * which ORs in the very same bits */
+		reader->cache |= GUINT64_FROM_BE (word) >> reader->bits;
+		reader->ptr += (63 - reader->bits) >> 3;
+		reader->bits |= 56;
+	} else {
+		while (reader->bits <= 56 && reader->ptr < reader->end) {
+			reader->cache |= (guint64) *reader->ptr++ << (56 - reader->bits);
+			reader->bits += 8;
+		}
+	}
+}
+
+static inline guint32
+dvb_bit_reader_peek_bits (DvbBitReader *reader, guint n)
+{
+	if (reader->bits < (gint) n)
+		dvb_bit_reader_refill (reader);
+
+	return (guint32) (reader->cache >> 32) >> (32 - n);
+}
+
+static inline void
+dvb_bit_reader_skip_bits (DvbBitReader *reader, guint n)
+{
+	reader->cache <<= n;
+	reader->bits -= n;
+}
+
+static inline guint32
+dvb_bit_reader_get_bits (DvbBitReader *reader, guint n)
+{
+	guint32 value = dvb_bit_reader_peek_bits (reader, n);
+
+	dvb_bit_reader_skip_bits (reader, n);
+
+	return value;
+}
+
+/* Amount of bits read so far, not counting zero bits read past the end */
+static inline gsize
+dvb_bit_reader_get_pos (const DvbBitReader *reader)
+{
+	gssize pos = (reader->ptr - reader->start) * 8 - reader->bits;
+
+	return MIN (pos, (reader->end - reader->start) * 8);
+}
+
+static inline gsize
+dvb_bit_reader_get_remaining (const DvbBitReader *reader)
+{
+	gssize remaining = (reader->end - reader->ptr) * 8 + reader->bits;
+
+	return MAX (remaining, 0);
+}
+
+G_END_DECLS
+
+#endif /* _DVB_BIT_READER_H_ */
@@ -0,0 +1,376 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "dvb-bufferpool.h"
+
+/**
+ * SECTION:dvb-bufferpool
+ * @short_description: a size class pool for region pixel buffers
+ * @stability: Private
+ *
+ * Caption regions change their size with nearly every line of text, and
+ * every display set hands out copies of all regions. The #DvbBufferPool
+ * keeps such buffers around by power of two size class, so that regions
+ * of a similar size reuse the same memory instead of going through the
+ * system allocator each time. Each buffer spans its whole size class.
+ *
+ * Shared buffers carry a reference count in front of their data, so that
+ * subtitles handed out to the application can use the region buffers of
+ * the decoder without copying them. The decoder treats a shared buffer as
+ * immutable and replaces it with a copy before drawing into it. Whoever
+ * drops the last reference frees the buffer; only the decoder gives it
+ * back to the pool, as the application may release it at any time.
+ * Shared buffers may also be placed in memory provided by the application,
+ * which then gets it back through its own free function.
+ */
+
+typedef struct _DvbSharedBufferHeader
+{
+	volatile gint ref_count;
+
+	/* The whole memory block the data was placed in */
+	gpointer mem;
+	gsize mem_size;
+
+	/* NULL if mem came from g_malloc() or a pool */
+	DvbSharedBufferFreeFunc free_func;
+	gpointer user_data;
+} DvbSharedBufferHeader;
+
+/* The header is right in front of the data, which is aligned to at least
+ * this for any pixel type */
+#define DVB_SHARED_BUFFER_MIN_ALIGN 16
+#define DVB_SHARED_BUFFER_HEADER(buf) ((DvbSharedBufferHeader *) (buf) - 1)
+#define DVB_SHARED_BUFFER_MEM_SIZE(size, align) (sizeof (DvbSharedBufferHeader) + (align) - 1 + (size))
+
+/* Returns the size class of size, or -1 if it is too large to be pooled */
+static gint
+dvb_buffer_pool_class (gsize size)
+{
+	gint shift = DVB_BUFFER_POOL_MIN_SHIFT;
+
+	while (((gsize) 1 << shift) < size) {
+		if (++shift > DVB_BUFFER_POOL_MAX_SHIFT)
+			return -1;
+	}
+
+	return shift - DVB_BUFFER_POOL_MIN_SHIFT;
+}
+
+#define DVB_BUFFER_POOL_CLASS_SIZE(class) ((gsize) 1 << ((class) + DVB_BUFFER_POOL_MIN_SHIFT))
+
+/**
+ * dvb_buffer_pool_init:
+ * @pool: the #DvbBufferPool to initialize
+ * @limit: the maximum number of bytes to keep in free buffers
+ *
+ * Initializes @pool to be empty.
+ */
+void
+dvb_buffer_pool_init (DvbBufferPool *pool, gsize limit)
+{
+	gint i;
+
+	for (i = 0; i < DVB_BUFFER_POOL_N_CLASSES; i++)
+		pool->free_lists[i] = NULL;
+	pool->retained = 0;
+	pool->limit = limit;
+}
+
+/**
+ * dvb_buffer_pool_alloc:
+ * @pool: a #DvbBufferPool
+ * @size: the number of bytes needed
+ *
+ * Gets a buffer of at least @size bytes from @pool, reusing a free buffer
+ * of the same size class if there is one. The contents are undefined.
+ *
+ * Returns: the buffer, or %NULL if @size is 0
+ */
+gpointer
+dvb_buffer_pool_alloc (DvbBufferPool *pool, gsize size)
+{
+	gpointer buf;
+	gint class;
+
+	if (size == 0)
+		return NULL;
+
+	class = dvb_buffer_pool_class (size);
+	if (class < 0)
+		return g_malloc (size);
+
+	buf = pool->free_lists[class];
+	if (buf) {
+		pool->free_lists[class] = *(gpointer *) buf;
+		pool->retained -= DVB_BUFFER_POOL_CLASS_SIZE (class);
+		return buf;
+	}
+
+	return g_malloc (DVB_BUFFER_POOL_CLASS_SIZE (class));
+}
+
+/**
+ * dvb_buffer_pool_free:
+ * @pool: a #DvbBufferPool
+ * @buf: a buffer from dvb_buffer_pool_alloc(), or %NULL
+ * @size: the size @buf was requested with
+ *
+ * Gives @buf back to @pool. It is kept for reuse unless that would take
+ * the pool over its limit, in which case it is freed.
+ */
+void
+dvb_buffer_pool_free (DvbBufferPool *pool, gpointer buf, gsize size)
+{
+	gint class;
+
+	if (buf == NULL)
+		return;
+
+	class = dvb_buffer_pool_class (size);
+	if (class < 0
+	    || pool->retained + DVB_BUFFER_POOL_CLASS_SIZE (class) > pool->limit) {
+		g_free (buf);
+		return;
+	}
+
+	*(gpointer *) buf = pool->free_lists[class];
+	pool->free_lists[class] = buf;
+	pool->retained += DVB_BUFFER_POOL_CLASS_SIZE (class);
+}
+
+/**
+ * dvb_buffer_pool_set_limit:
+ * @pool: a #DvbBufferPool
+ * @limit: the maximum number of bytes to keep in free buffers
+ *
+ * Changes the limit of @pool, freeing kept buffers, largest first, until
+ * it is met.
+ */
+void
+dvb_buffer_pool_set_limit (DvbBufferPool *pool, gsize limit)
+{
+	gpointer buf;
+	gint class;
+
+	pool->limit = limit;
+
+	for (class = DVB_BUFFER_POOL_N_CLASSES - 1;
+	     class >= 0 && pool->retained > limit; class--) {
+		while (pool->free_lists[class] && pool->retained > limit) {
+			buf = pool->free_lists[class];
+			pool->free_lists[class] = *(gpointer *) buf;
+			pool->retained -= DVB_BUFFER_POOL_CLASS_SIZE (class);
+			g_free (buf);
+		}
+	}
+}
+
+/**
+ * dvb_buffer_pool_clear:
+ * @pool: a #DvbBufferPool
+ *
+ * Frees all buffers kept in @pool. Buffers still in use aren't affected.
+ */
+void
+dvb_buffer_pool_clear (DvbBufferPool *pool)
+{
+	gsize limit = pool->limit;
+
+	dvb_buffer_pool_set_limit (pool, 0);
+	pool->limit = limit;
+}
+
+/* Places a buffer of a reference count of 1 into the memory block mem */
+static gpointer
+dvb_shared_buffer_init (gpointer mem, gsize mem_size, gsize align,
+                        DvbSharedBufferFreeFunc free_func, gpointer user_data)
+{
+	DvbSharedBufferHeader *header;
+	guint8 *data;
+
+	align = MAX (align, DVB_SHARED_BUFFER_MIN_ALIGN);
+	data = (guint8 *) (((gsize) mem + sizeof (DvbSharedBufferHeader) + align - 1) & ~(align - 1));
+
+	header = DVB_SHARED_BUFFER_HEADER (data);
+	header->ref_count = 1;
+	header->mem = mem;
+	header->mem_size = mem_size;
+	header->free_func = free_func;
+	header->user_data = user_data;
+
+	return data;
+}
+
+static void
+dvb_shared_buffer_free_mem (DvbSharedBufferHeader *header, DvbBufferPool *pool)
+{
+	if (header->free_func)
+		header->free_func (header->mem, header->user_data);
+	else if (pool)
+		dvb_buffer_pool_free (pool, header->mem, header->mem_size);
+	else
+		g_free (header->mem);
+}
+
+/**
+ * dvb_shared_buffer_new:
+ * @size: the number of bytes needed
+ *
+ * Allocates a reference counted buffer outside of any pool, with a
+ * reference count of 1.
+ *
+ * Returns: the buffer data
+ */
+gpointer
+dvb_shared_buffer_new (gsize size)
+{
+	gsize mem_size = DVB_SHARED_BUFFER_MEM_SIZE (size, DVB_SHARED_BUFFER_MIN_ALIGN);
+
+	return dvb_shared_buffer_init (g_malloc (mem_size), mem_size, DVB_SHARED_BUFFER_MIN_ALIGN, NULL, NULL);
+}
+
+/**
+ * dvb_shared_buffer_new_full:
+ * @size: the number of bytes needed
+ * @align: the alignment of the data, a power of two
+ * @alloc_func: the function to allocate the memory block with
+ * @free_func: the function to free the memory block with once the last
+ *   reference is dropped, from whatever thread that happens in
+ * @user_data: data to pass to @alloc_func and @free_func
+ *
+ * Allocates a reference counted buffer with a reference count of 1 in a
+ * memory block of the caller's choice. The block is slightly larger than
+ * @size to make room for the reference count and the alignment.
+ *
+ * Returns: the buffer data, or %NULL if @size is 0 or @alloc_func failed
+ */
+gpointer
+dvb_shared_buffer_new_full (gsize size, gsize align,
+                            DvbSharedBufferAllocFunc alloc_func,
+                            DvbSharedBufferFreeFunc free_func,
+                            gpointer user_data)
+{
+	gsize mem_size;
+	gpointer mem;
+
+	if (size == 0)
+		return NULL;
+
+	align = MAX (align, DVB_SHARED_BUFFER_MIN_ALIGN);
+	mem_size = DVB_SHARED_BUFFER_MEM_SIZE (size, align);
+	mem = alloc_func (mem_size, user_data);
+	if (mem == NULL)
+		return NULL;
+
+	return dvb_shared_buffer_init (mem, mem_size, align, free_func, user_data);
+}
+
+/**
+ * dvb_buffer_pool_alloc_shared:
+ * @pool: a #DvbBufferPool
+ * @size: the number of bytes needed
+ * @align: the alignment of the data, a power of two
+ *
+ * Gets a reference counted buffer from @pool, with a reference count of 1.
+ * The contents are undefined.
+ *
+ * Returns: the buffer data, or %NULL if @size is 0
+ */
+gpointer
+dvb_buffer_pool_alloc_shared (DvbBufferPool *pool, gsize size, gsize align)
+{
+	gsize mem_size;
+
+	if (size == 0)
+		return NULL;
+
+	align = MAX (align, DVB_SHARED_BUFFER_MIN_ALIGN);
+	mem_size = DVB_SHARED_BUFFER_MEM_SIZE (size, align);
+
+	return dvb_shared_buffer_init (dvb_buffer_pool_alloc (pool, mem_size), mem_size, align, NULL, NULL);
+}
+
+/**
+ * dvb_shared_buffer_ref:
+ * @buf: a shared buffer, or %NULL
+ *
+ * Adds a reference to @buf. This is thread-safe.
+ *
+ * Returns: @buf
+ */
+gpointer
+dvb_shared_buffer_ref (gpointer buf)
+{
+	if (buf)
+		g_atomic_int_inc (&DVB_SHARED_BUFFER_HEADER (buf)->ref_count);
+
+	return buf;
+}
+
+/**
+ * dvb_shared_buffer_unref:
+ * @buf: a shared buffer, or %NULL
+ *
+ * Drops a reference to @buf, freeing it if it was the last one. This is
+ * thread-safe.
+ */
+void
+dvb_shared_buffer_unref (gpointer buf)
+{
+	if (buf && g_atomic_int_dec_and_test (&DVB_SHARED_BUFFER_HEADER (buf)->ref_count))
+		dvb_shared_buffer_free_mem (DVB_SHARED_BUFFER_HEADER (buf), NULL);
+}
+
+/**
+ * dvb_buffer_pool_release:
+ * @pool: the #DvbBufferPool @buf was allocated from
+ * @buf: a shared buffer, or %NULL
+ *
+ * Drops a reference to @buf, giving it back to @pool if it was the last
+ * one and came from there.
+ */
+void
+dvb_buffer_pool_release (DvbBufferPool *pool, gpointer buf)
+{
+	DvbSharedBufferHeader *header;
+
+	if (buf == NULL)
+		return;
+
+	header = DVB_SHARED_BUFFER_HEADER (buf);
+	if (g_atomic_int_dec_and_test (&header->ref_count))
+		dvb_shared_buffer_free_mem (header, pool);
+}
+
+/**
+ * dvb_shared_buffer_is_shared:
+ * @buf: a shared buffer
+ *
+ * Checks whether anyone besides the caller holds a reference to @buf. If
+ * not, the caller may modify it in place.
+ *
+ * Returns: %TRUE if @buf has more than one reference
+ */
+gboolean
+dvb_shared_buffer_is_shared (gpointer buf)
+{
+	return g_atomic_int_get (&DVB_SHARED_BUFFER_HEADER (buf)->ref_count) > 1;
+}
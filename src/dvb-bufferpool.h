@@ -0,0 +1,71 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DVB_BUFFER_POOL_H_
+#define _DVB_BUFFER_POOL_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Size classes are powers of two from 2^DVB_BUFFER_POOL_MIN_SHIFT to
+ * 2^DVB_BUFFER_POOL_MAX_SHIFT bytes; larger buffers aren't pooled */
+#define DVB_BUFFER_POOL_MIN_SHIFT 10
+#define DVB_BUFFER_POOL_MAX_SHIFT 24
+#define DVB_BUFFER_POOL_N_CLASSES (DVB_BUFFER_POOL_MAX_SHIFT - DVB_BUFFER_POOL_MIN_SHIFT + 1)
+
+/* Default cap on the bytes kept in the free lists of a pool */
+#define DVB_BUFFER_POOL_DEFAULT_LIMIT (4 * 1024 * 1024)
+
+/**
+ * DvbBufferPool:
+ *
+ * A pool of pixel buffers, sorted into power of two size classes. Buffers
+ * given back are kept on the free list of their class for the next
+ * allocation falling into it, as long as the total size of the kept
+ * buffers stays within the limit of the pool.
+ */
+typedef struct _DvbBufferPool
+{
+	gpointer free_lists[DVB_BUFFER_POOL_N_CLASSES];
+	gsize retained;
+	gsize limit;
+} DvbBufferPool;
+
+void      dvb_buffer_pool_init      (DvbBufferPool *pool, gsize limit);
+gpointer  dvb_buffer_pool_alloc     (DvbBufferPool *pool, gsize size);
+void      dvb_buffer_pool_free      (DvbBufferPool *pool, gpointer buf, gsize size);
+void      dvb_buffer_pool_set_limit (DvbBufferPool *pool, gsize limit);
+void      dvb_buffer_pool_clear     (DvbBufferPool *pool);
+
+typedef gpointer (*DvbSharedBufferAllocFunc) (gsize size, gpointer user_data);
+typedef void     (*DvbSharedBufferFreeFunc)  (gpointer mem, gpointer user_data);
+
+gpointer  dvb_shared_buffer_new         (gsize size);
+gpointer  dvb_shared_buffer_new_full    (gsize size, gsize align, DvbSharedBufferAllocFunc alloc_func, DvbSharedBufferFreeFunc free_func, gpointer user_data);
+gpointer  dvb_buffer_pool_alloc_shared  (DvbBufferPool *pool, gsize size, gsize align);
+gpointer  dvb_shared_buffer_ref         (gpointer buf);
+void      dvb_shared_buffer_unref       (gpointer buf);
+void      dvb_buffer_pool_release       (DvbBufferPool *pool, gpointer buf);
+gboolean  dvb_shared_buffer_is_shared   (gpointer buf);
+
+G_END_DECLS
+
+#endif /* _DVB_BUFFER_POOL_H_ */
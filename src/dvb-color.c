@@ -0,0 +1,61 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "dvb-color.h"
+
+/**
+ * SECTION:dvb-color
+ * @short_description: colour conversions shared by the decoder and compositor
+ * @stability: Private
+ *
+ * Conversions of palette entries between RGB and YUV, kept in one place so
+ * that the YUV palettes of #DVBSubtitlePicture and the colours blended onto
+ * YUV frames agree.
+ */
+
+/**
+ * dvb_color_argb_to_ayuv:
+ * @argb: a palette entry, 0xAARRGGBB
+ * @matrix: the colour matrix to convert with
+ *
+ * Converts a palette entry from full range RGB to studio range YUV.
+ *
+ * Return value: the entry as 0xAAYYUUVV
+ */
+guint32
+dvb_color_argb_to_ayuv (guint32 argb, DVBSubtitleColorMatrix matrix)
+{
+	gint r = (argb >> 16) & 0xff;
+	gint g = (argb >> 8) & 0xff;
+	gint b = argb & 0xff;
+	gint y, u, v;
+
+	if (matrix == DVB_SUBTITLE_COLOR_MATRIX_BT709) {
+		y = ((47 * r + 157 * g + 16 * b + 128) >> 8) + 16;
+		u = ((-26 * r - 87 * g + 112 * b + 128) >> 8) + 128;
+		v = ((112 * r - 102 * g - 10 * b + 128) >> 8) + 128;
+	} else {
+		y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+		v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+	}
+
+	return (argb & 0xff000000) | ((guint32) y << 16) | ((guint32) u << 8) | (guint32) v;
+}
@@ -0,0 +1,540 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "dvb-demux.h"
+#include <string.h> /* memcpy */
+#include "dvb-log.h"
+#include "dvb-ringbuffer.h" /* DVB_PES_PACKET_MAX_SIZE */
+
+/**
+ * SECTION:dvb-demux
+ * @short_description: MPEG transport stream demuxing helpers
+ * @stability: Private
+ *
+ * Software demuxing of the MPEG transport stream, for feeding the subtitle
+ * parser from recorded streams and DVR devices without the kernel PES filter.
+ * Transport stream packets are parsed in place with dvb_ts_packet_parse() and
+ * the PES packets of a PID are reassembled from them with a #DvbPesAssembler.
+ */
+
+/**
+ * dvb_ts_sync:
+ * @data: the data to look for a transport stream packet start in
+ * @len: length of @data
+ *
+ * Finds the position of the first transport stream packet in @data. A position
+ * is accepted when it holds a sync byte and so do the next two packet positions,
+ * as far as @data extends.
+ *
+ * Return value: offset of the first packet, -1 if no sync byte was found at all
+ */
+gint
+dvb_ts_sync (const guint8 *data, gint len)
+{
+	const guint8 *p = data;
+	const guint8 *end = data + len;
+
+	while ((p = memchr (p, DVB_TS_SYNC_BYTE, end - p))) {
+		if ((p + DVB_TS_PACKET_SIZE >= end || p[DVB_TS_PACKET_SIZE] == DVB_TS_SYNC_BYTE) &&
+		    (p + 2 * DVB_TS_PACKET_SIZE >= end || p[2 * DVB_TS_PACKET_SIZE] == DVB_TS_SYNC_BYTE))
+			return p - data;
+		++p;
+	}
+
+	return -1;
+}
+
+/**
+ * dvb_ts_next_packet:
+ * @data: transport stream data
+ * @len: length of @data
+ * @pos: the current position in @data, advanced past the returned packet
+ * @resynced: return location for whether data was skipped to regain the sync
+ *
+ * Gets the next complete transport stream packet in @data, regaining the
+ * sync first if @pos isn't at a sync byte. @resynced is also set when %NULL
+ * is returned; if it is %TRUE, the caller has to drop everything it was
+ * reassembling with dvb_pes_assembler_reset() and the like.
+ *
+ * Return value: the next packet, or %NULL if @data has no more complete packets
+ */
+guint8 *
+dvb_ts_next_packet (guint8 *data, gint len, gint *pos, gboolean *resynced)
+{
+	guint8 *packet;
+	gint offset;
+
+	*resynced = FALSE;
+
+	while (len - *pos >= DVB_TS_PACKET_SIZE) {
+		if (data[*pos] == DVB_TS_SYNC_BYTE) {
+			packet = data + *pos;
+			*pos += DVB_TS_PACKET_SIZE;
+			return packet;
+		}
+
+		offset = dvb_ts_sync (data + *pos, len - *pos);
+		dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_WARNING,
+		         "Lost transport stream sync, skipping %d bytes",
+		         offset < 0 ? len - *pos : offset);
+		*resynced = TRUE;
+		if (offset < 0) {
+			*pos = len;
+			return NULL;
+		}
+		*pos += offset;
+	}
+
+	return NULL;
+}
+
+/**
+ * dvb_ts_packet_parse:
+ * @data: a #DVB_TS_PACKET_SIZE bytes transport stream packet, starting with the sync byte
+ * @packet: the #DvbTsPacket to fill in
+ *
+ * Parses the header and adaptation field of a transport stream packet.
+ *
+ * Return value: %TRUE if the packet is valid
+ */
+gboolean
+dvb_ts_packet_parse (guint8 *data, DvbTsPacket *packet)
+{
+	guint8 adaptation_field_control;
+	gint pos = 4;
+
+	if (data[0] != DVB_TS_SYNC_BYTE)
+		return FALSE;
+
+	packet->transport_error = (data[1] & 0x80) != 0;
+	packet->payload_unit_start = (data[1] & 0x40) != 0;
+	packet->pid = ((data[1] & 0x1F) << 8) | data[2];
+	adaptation_field_control = (data[3] >> 4) & 3;
+	packet->continuity_counter = data[3] & 0x0F;
+	packet->discontinuity = FALSE;
+	packet->payload = NULL;
+	packet->payload_len = 0;
+
+	if (adaptation_field_control & 0x2) {
+		guint8 adaptation_field_length = data[pos++];
+
+		if (adaptation_field_length > 0)
+			packet->discontinuity = (data[pos] & 0x80) != 0;
+		pos += adaptation_field_length;
+
+		if (pos > DVB_TS_PACKET_SIZE) {
+			dvb_log (DVB_LOG_STREAM, G_LOG_LEVEL_WARNING,
+			         "adaptation_field_length %u too big on PID %u",
+			         adaptation_field_length, packet->pid);
+			return FALSE;
+		}
+	}
+
+	if (adaptation_field_control & 0x1) {
+		packet->payload = data + pos;
+		packet->payload_len = DVB_TS_PACKET_SIZE - pos;
+	}
+
+	return adaptation_field_control != 0;
+}
+
+/**
+ * dvb_pes_parse_header:
+ * @data: the start of a PES packet
+ * @len: length of @data
+ * @pts: return location for the PTS, set to 0 if the packet has none
+ * @payload_len: return location for the payload length, -1 if unbounded
+ *
+ * Parses the header of a PES packet carrying private_stream_1 data.
+ *
+ * Return value: the length of the PES header (the offset of the payload),
+ *               -1 if @data doesn't start a private_stream_1 PES packet or
+ *               doesn't contain the whole header.
+ */
+gint
+dvb_pes_parse_header (const guint8 *data, gint len, guint64 *pts, gint *payload_len)
+{
+	guint16 PES_packet_len;
+	guint8 PES_header_data_len;
+
+	if (len < 9)
+		return -1;
+
+	if (data[0] != 0x00 || data[1] != 0x00 || data[2] != 0x01 ||
+	    data[3] != DVB_PES_PRIVATE_STREAM_1)
+		return -1;
+
+	PES_packet_len = (data[4] << 8) | data[5];
+	PES_header_data_len = data[8];
+
+	if (len < 9 + PES_header_data_len)
+		return -1;
+
+	*pts = 0;
+	if ((data[7] & 0x80) && PES_header_data_len >= 5)
+		*pts = dvb_pes_read_timestamp (data + 9);
+
+	if (PES_packet_len == 0)
+		*payload_len = -1;
+	else if (PES_packet_len < 3 + PES_header_data_len)
+		return -1;
+	else
+		*payload_len = PES_packet_len - 3 - PES_header_data_len;
+
+	return 9 + PES_header_data_len;
+}
+
+/* Checks the continuity_counter of a packet with payload for a PID, shared by
+ * the PES and section assemblers. Returns FALSE if the packet is a duplicate
+ * that should be ignored; *lost is set if packets were lost before it */
+static gboolean
+dvb_ts_check_continuity (gint *continuity_counter, const DvbTsPacket *packet, gboolean *lost)
+{
+	*lost = FALSE;
+
+	if (*continuity_counter >= 0 && !packet->discontinuity) {
+		if (packet->continuity_counter == *continuity_counter) {
+			dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_DEBUG,
+			         "Duplicate packet on PID %u, ignoring", packet->pid);
+			return FALSE;
+		}
+		if (packet->continuity_counter != ((*continuity_counter + 1) & 0x0F)) {
+			dvb_log (DVB_LOG_STREAM, G_LOG_LEVEL_WARNING,
+			         "Continuity counter error on PID %u: expected %d, got %u",
+			         packet->pid, (*continuity_counter + 1) & 0x0F,
+			         packet->continuity_counter);
+			*lost = TRUE;
+		}
+	}
+	*continuity_counter = packet->continuity_counter;
+
+	return TRUE;
+}
+
+/**
+ * dvb_pes_assembler_init:
+ * @assembler: the #DvbPesAssembler to initialize
+ * @pid: the PID to reassemble PES packets of
+ * @func: the function to call with every complete PES packet
+ * @user_data: user data to pass to @func
+ *
+ * Initializes a #DvbPesAssembler.
+ */
+void
+dvb_pes_assembler_init (DvbPesAssembler *assembler, guint16 pid,
+                        DvbPesFunc func, gpointer user_data)
+{
+	assembler->pid = pid;
+	assembler->buf = NULL;
+	assembler->func = func;
+	assembler->user_data = user_data;
+	dvb_pes_assembler_reset (assembler);
+}
+
+/**
+ * dvb_pes_assembler_reset:
+ * @assembler: a #DvbPesAssembler
+ *
+ * Drops any partially reassembled PES packet and the continuity state,
+ * e.g after a loss of transport stream sync.
+ */
+void
+dvb_pes_assembler_reset (DvbPesAssembler *assembler)
+{
+	assembler->continuity_counter = -1;
+	assembler->in_packet = FALSE;
+	assembler->pts = 0;
+	assembler->expected = 0;
+	assembler->len = 0;
+}
+
+/**
+ * dvb_pes_assembler_clear:
+ * @assembler: a #DvbPesAssembler
+ *
+ * Frees the resources held by @assembler.
+ */
+void
+dvb_pes_assembler_clear (DvbPesAssembler *assembler)
+{
+	g_free (assembler->buf);
+	assembler->buf = NULL;
+	dvb_pes_assembler_reset (assembler);
+}
+
+static void
+dvb_pes_assembler_append (DvbPesAssembler *assembler, guint8 *data, gint len)
+{
+	gint max_len = assembler->expected >= 0 ? assembler->expected : DVB_PES_PACKET_MAX_SIZE;
+
+	if (!assembler->buf)
+		assembler->buf = g_malloc (DVB_PES_PACKET_MAX_SIZE);
+
+	if (assembler->len + len > max_len) {
+		if (assembler->expected < 0)
+			dvb_log (DVB_LOG_STREAM, G_LOG_LEVEL_WARNING,
+			         "Unbounded PES packet on PID %u exceeds %d bytes, truncating",
+			         assembler->pid, max_len);
+		len = max_len - assembler->len;
+	}
+
+	memcpy (assembler->buf + assembler->len, data, len);
+	assembler->len += len;
+}
+
+/**
+ * dvb_pes_assembler_push:
+ * @assembler: a #DvbPesAssembler
+ * @packet: a transport stream packet of the PID of @assembler
+ *
+ * Adds a transport stream packet to the PES packet being reassembled, calling
+ * the #DvbPesFunc of @assembler when a PES packet is complete. A PES packet
+ * that is contained in a single transport stream packet is passed on directly
+ * from the transport stream packet data, without copying.
+ */
+void
+dvb_pes_assembler_push (DvbPesAssembler *assembler, const DvbTsPacket *packet)
+{
+	guint8 *payload = packet->payload;
+	gint payload_len = packet->payload_len;
+	gint header_len;
+	gboolean lost;
+
+	if (packet->transport_error) {
+		dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_INFO,
+		         "Transport error indicator set on PID %u, dropping PES packet", packet->pid);
+		dvb_pes_assembler_reset (assembler);
+		return;
+	}
+
+	/* The continuity_counter is only incremented by packets with a payload */
+	if (payload_len == 0 || !dvb_ts_check_continuity (&assembler->continuity_counter, packet, &lost))
+		return;
+
+	if (lost && assembler->in_packet) {
+		dvb_log (DVB_LOG_STREAM, G_LOG_LEVEL_WARNING,
+		         "Dropping incomplete PES packet on PID %u", packet->pid);
+		assembler->in_packet = FALSE;
+	}
+
+	if (packet->payload_unit_start) {
+		/* An unbounded PES packet is only known to be complete when the next one starts */
+		if (assembler->in_packet) {
+			if (assembler->expected < 0)
+				assembler->func (assembler->pts, assembler->buf, assembler->len, assembler->user_data);
+			else
+				dvb_log (DVB_LOG_STREAM, G_LOG_LEVEL_WARNING,
+				         "PES packet on PID %u ended %d bytes short", packet->pid,
+				         assembler->expected - assembler->len);
+		}
+		assembler->in_packet = FALSE;
+		assembler->len = 0;
+
+		header_len = dvb_pes_parse_header (payload, payload_len, &assembler->pts,
+		                                   &assembler->expected);
+		if (header_len < 0) {
+			dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_INFO,
+			         "Not a private_stream_1 PES packet start on PID %u, skipping", packet->pid);
+			return;
+		}
+
+		payload += header_len;
+		payload_len -= header_len;
+
+		/* The whole PES packet is in this transport stream packet - feed in place */
+		if (assembler->expected >= 0 && payload_len >= assembler->expected) {
+			assembler->func (assembler->pts, payload, assembler->expected, assembler->user_data);
+			return;
+		}
+
+		assembler->in_packet = TRUE;
+	} else if (!assembler->in_packet) {
+		return;                 /* waiting for a payload_unit_start_indicator */
+	}
+
+	dvb_pes_assembler_append (assembler, payload, payload_len);
+
+	if (assembler->expected >= 0 && assembler->len >= assembler->expected) {
+		assembler->in_packet = FALSE;
+		assembler->func (assembler->pts, assembler->buf, assembler->len, assembler->user_data);
+		assembler->len = 0;
+	}
+}
+
+/**
+ * dvb_crc32:
+ * @data: the data to checksum
+ * @len: length of @data
+ *
+ * Calculates the MPEG-2 CRC_32 of @data. Calculated over a whole PSI section
+ * including its CRC_32 field, the result is zero for an intact section.
+ *
+ * Return value: the CRC
+ */
+guint32
+dvb_crc32 (const guint8 *data, gint len)
+{
+	guint32 crc = 0xFFFFFFFF;
+	gint i, bit;
+
+	/* Bitwise, as only the rarely repeated PSI tables are checksummed */
+	for (i = 0; i < len; ++i) {
+		crc ^= (guint32) data[i] << 24;
+		for (bit = 0; bit < 8; ++bit)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+	}
+
+	return crc;
+}
+
+/**
+ * dvb_section_assembler_init:
+ * @assembler: the #DvbSectionAssembler to initialize
+ * @pid: the PID to reassemble sections of
+ * @func: the function to call with every complete section
+ * @user_data: user data to pass to @func
+ *
+ * Initializes a #DvbSectionAssembler.
+ */
+void
+dvb_section_assembler_init (DvbSectionAssembler *assembler, guint16 pid,
+                            DvbSectionFunc func, gpointer user_data)
+{
+	assembler->pid = pid;
+	assembler->func = func;
+	assembler->user_data = user_data;
+	dvb_section_assembler_reset (assembler);
+}
+
+/**
+ * dvb_section_assembler_reset:
+ * @assembler: a #DvbSectionAssembler
+ *
+ * Drops any partially reassembled section and the continuity state.
+ */
+void
+dvb_section_assembler_reset (DvbSectionAssembler *assembler)
+{
+	assembler->continuity_counter = -1;
+	assembler->in_section = FALSE;
+	assembler->len = 0;
+}
+
+/* Collects section bytes from data, calling func for each complete section.
+ * Returns the amount of bytes used */
+static gint
+dvb_section_assembler_collect (DvbSectionAssembler *assembler, const guint8 *data, gint len)
+{
+	gint pos = 0, take, total;
+
+	while (assembler->in_section && pos < len) {
+		if (assembler->len < 3)
+			total = 3;
+		else
+			total = 3 + (((assembler->buf[1] & 0x0F) << 8) | assembler->buf[2]);
+
+		take = MIN (total - assembler->len, len - pos);
+		memcpy (assembler->buf + assembler->len, data + pos, take);
+		assembler->len += take;
+		pos += take;
+
+		if (assembler->len == 3) {
+			if (assembler->buf[0] == 0xFF) {
+				/* table_id 0xFF is stuffing until the end of the packet */
+				assembler->in_section = FALSE;
+				assembler->len = 0;
+				return len;
+			}
+			total = 3 + (((assembler->buf[1] & 0x0F) << 8) | assembler->buf[2]);
+			if (total > DVB_SECTION_MAX_SIZE) {
+				dvb_log (DVB_LOG_STREAM, G_LOG_LEVEL_WARNING,
+				         "Section length %d on PID %u too big", total, assembler->pid);
+				assembler->in_section = FALSE;
+				assembler->len = 0;
+				return len;
+			}
+		}
+
+		if (assembler->len >= 3 && assembler->len == total) {
+			if (dvb_crc32 (assembler->buf, total) == 0)
+				assembler->func (assembler->buf, total, assembler->user_data);
+			else
+				dvb_log (DVB_LOG_STREAM, G_LOG_LEVEL_WARNING,
+				         "CRC error in section with table_id 0x%x on PID %u",
+				         assembler->buf[0], assembler->pid);
+			assembler->len = 0;
+		}
+	}
+
+	return pos;
+}
+
+/**
+ * dvb_section_assembler_push:
+ * @assembler: a #DvbSectionAssembler
+ * @packet: a transport stream packet of the PID of @assembler
+ *
+ * Adds a transport stream packet to the sections being reassembled, calling
+ * the #DvbSectionFunc of @assembler for every complete section.
+ */
+void
+dvb_section_assembler_push (DvbSectionAssembler *assembler, const DvbTsPacket *packet)
+{
+	const guint8 *payload = packet->payload;
+	gint payload_len = packet->payload_len;
+	gboolean lost;
+	guint8 pointer_field;
+
+	if (packet->transport_error) {
+		dvb_section_assembler_reset (assembler);
+		return;
+	}
+
+	if (payload_len == 0 || !dvb_ts_check_continuity (&assembler->continuity_counter, packet, &lost))
+		return;
+
+	if (lost) {
+		assembler->in_section = FALSE;
+		assembler->len = 0;
+	}
+
+	if (packet->payload_unit_start) {
+		pointer_field = *payload++;
+		payload_len--;
+
+		if (pointer_field > payload_len) {
+			dvb_log (DVB_LOG_STREAM, G_LOG_LEVEL_WARNING,
+			         "Invalid pointer_field %u on PID %u", pointer_field, packet->pid);
+			assembler->in_section = FALSE;
+			assembler->len = 0;
+			return;
+		}
+
+		/* The bytes before the pointed position finish the previous section */
+		dvb_section_assembler_collect (assembler, payload, pointer_field);
+		payload += pointer_field;
+		payload_len -= pointer_field;
+
+		assembler->in_section = TRUE;
+		assembler->len = 0;
+	}
+
+	dvb_section_assembler_collect (assembler, payload, payload_len);
+}
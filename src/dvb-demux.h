@@ -0,0 +1,160 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DVB_DEMUX_H_
+#define _DVB_DEMUX_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define DVB_TS_PACKET_SIZE 188
+#define DVB_TS_SYNC_BYTE 0x47
+#define DVB_TS_PID_INVALID 0xFFFF
+
+/* PES stream_id of private_stream_1, which carries DVB subtitles */
+#define DVB_PES_PRIVATE_STREAM_1 0xBD
+
+/**
+ * DvbTsPacket:
+ * @pid: the PID of the packet
+ * @payload_unit_start: payload_unit_start_indicator, a PES packet starts in this packet
+ * @transport_error: transport_error_indicator, the packet is known to be corrupt
+ * @discontinuity: discontinuity_indicator of the adaptation field
+ * @continuity_counter: the 4-bit continuity_counter
+ * @payload: the payload of the packet, pointing into the packet data
+ * @payload_len: the length of @payload, 0 if the packet carries no payload
+ *
+ * A parsed MPEG-TS packet header.
+ */
+typedef struct _DvbTsPacket
+{
+	guint16 pid;
+	gboolean payload_unit_start;
+	gboolean transport_error;
+	gboolean discontinuity;
+	guint8 continuity_counter;
+
+	guint8 *payload;
+	gint payload_len;
+} DvbTsPacket;
+
+/**
+ * DvbPesFunc:
+ * @pts: the PTS of the PES packet, 0 if it had none
+ * @data: the PES packet payload, i.e the data after the PES header
+ * @len: length of @data
+ * @user_data: user data as given to dvb_pes_assembler_init()
+ *
+ * Called by a #DvbPesAssembler for every reassembled PES packet. @data is
+ * only valid for the duration of the call.
+ */
+typedef void (*DvbPesFunc) (guint64 pts, guint8 *data, gint len, gpointer user_data);
+
+/**
+ * DvbPesAssembler:
+ *
+ * Reassembles the PES packets of one PID from its transport stream packets.
+ */
+typedef struct _DvbPesAssembler
+{
+	guint16 pid;
+	gint continuity_counter; /* -1 if not known */
+	gboolean in_packet;
+
+	guint64 pts;
+	gint expected;           /* payload length of the current PES packet, -1 if unbounded */
+	guint8 *buf;
+	gint len;
+
+	DvbPesFunc func;
+	gpointer user_data;
+} DvbPesAssembler;
+
+gint     dvb_ts_sync                (const guint8 *data, gint len);
+guint8  *dvb_ts_next_packet         (guint8 *data, gint len, gint *pos, gboolean *resynced);
+gboolean dvb_ts_packet_parse        (guint8 *data, DvbTsPacket *packet);
+
+gint     dvb_pes_parse_header       (const guint8 *data, gint len, guint64 *pts, gint *payload_len);
+
+void     dvb_pes_assembler_init     (DvbPesAssembler *assembler, guint16 pid, DvbPesFunc func, gpointer user_data);
+void     dvb_pes_assembler_reset    (DvbPesAssembler *assembler);
+void     dvb_pes_assembler_clear    (DvbPesAssembler *assembler);
+void     dvb_pes_assembler_push     (DvbPesAssembler *assembler, const DvbTsPacket *packet);
+
+/**
+ * DvbSectionFunc:
+ * @section: a complete PSI section, starting with the table_id
+ * @len: length of @section, including the CRC_32
+ * @user_data: user data as given to dvb_section_assembler_init()
+ *
+ * Called by a #DvbSectionAssembler for every reassembled section with a valid CRC.
+ */
+typedef void (*DvbSectionFunc) (const guint8 *section, gint len, gpointer user_data);
+
+/* Large enough for any PSI section, which are limited to 1024 bytes after the
+ * section_length field; private sections can be up to 4096 bytes */
+#define DVB_SECTION_MAX_SIZE 4096
+
+/**
+ * DvbSectionAssembler:
+ *
+ * Reassembles the PSI sections (e.g PAT and PMT) of one PID from its
+ * transport stream packets.
+ */
+typedef struct _DvbSectionAssembler
+{
+	guint16 pid;
+	gint continuity_counter; /* -1 if not known */
+	gboolean in_section;
+
+	guint8 buf[DVB_SECTION_MAX_SIZE];
+	gint len;
+
+	DvbSectionFunc func;
+	gpointer user_data;
+} DvbSectionAssembler;
+
+void     dvb_section_assembler_init  (DvbSectionAssembler *assembler, guint16 pid, DvbSectionFunc func, gpointer user_data);
+void     dvb_section_assembler_reset (DvbSectionAssembler *assembler);
+void     dvb_section_assembler_push  (DvbSectionAssembler *assembler, const DvbTsPacket *packet);
+
+guint32  dvb_crc32                   (const guint8 *data, gint len);
+
+/**
+ * dvb_pes_read_timestamp:
+ * @data: the 5 bytes of a PES PTS or DTS field
+ *
+ * Return value: the 33-bit timestamp value, ignoring the marker bits
+ */
+static inline guint64
+dvb_pes_read_timestamp (const guint8 *data)
+{
+	/* '001x', PTS[32..30], marker, PTS[29..15], marker, PTS[14..0], marker */
+	return (((guint64) (data[0] & 0x0E)) << 29) |  /* PTS[32..30] */
+	       (((guint64) data[1]) << 22) |           /* PTS[29..22] */
+	       (((guint64) (data[2] & 0xFE)) << 14) |  /* PTS[21..15] */
+	       (((guint64) data[3]) << 7) |            /* PTS[14.. 7] */
+	       (((guint64) (data[4] & 0xFE)) >> 1);    /* PTS[ 6.. 0] */
+}
+
+G_END_DECLS
+
+#endif /* _DVB_DEMUX_H_ */
@@ -0,0 +1,163 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "dvb-ringbuffer.h"
+#include <string.h> /* memcpy */
+
+/**
+ * SECTION:dvb-ringbuffer
+ * @short_description: a fixed capacity byte ring buffer for PES accumulation
+ * @stability: Private
+ *
+ * The #DvbRingBuffer accumulates the raw PES stream read from a demux file
+ * descriptor. Data is read straight into the free space of the ring with
+ * dvb_ring_buffer_write_ptr() and dvb_ring_buffer_commit(), and complete
+ * packets are handed to the parser in place with dvb_ring_buffer_peek().
+ * Consuming a packet only advances the read position, so unlike erasing
+ * from the front of a linear buffer, there is no memmove of the remaining
+ * data per packet.
+ */
+
+/**
+ * dvb_ring_buffer_init:
+ * @ring: the #DvbRingBuffer to initialize
+ * @size: the capacity in bytes, rounded up to a power of two
+ *
+ * Allocates the storage of @ring. The capacity must be able to hold
+ * the largest possible PES packet.
+ */
+void
+dvb_ring_buffer_init (DvbRingBuffer *ring, gsize size)
+{
+	gsize capacity = 1;
+
+	g_return_if_fail (size >= DVB_PES_PACKET_MAX_SIZE);
+
+	while (capacity < size)
+		capacity <<= 1;
+
+	ring->size = capacity;
+	ring->mask = capacity - 1;
+	ring->data = g_malloc (capacity + DVB_PES_PACKET_MAX_SIZE);
+	ring->head = ring->tail = 0;
+}
+
+/**
+ * dvb_ring_buffer_clear:
+ * @ring: a #DvbRingBuffer
+ *
+ * Discards all data in @ring.
+ */
+void
+dvb_ring_buffer_clear (DvbRingBuffer *ring)
+{
+	ring->head = ring->tail = 0;
+}
+
+/**
+ * dvb_ring_buffer_free:
+ * @ring: a #DvbRingBuffer
+ *
+ * Frees the storage of @ring.
+ */
+void
+dvb_ring_buffer_free (DvbRingBuffer *ring)
+{
+	g_free (ring->data);
+	ring->data = NULL;
+	ring->size = ring->mask = 0;
+	ring->head = ring->tail = 0;
+}
+
+/**
+ * dvb_ring_buffer_write_ptr:
+ * @ring: a #DvbRingBuffer
+ * @len: return location for the amount of contiguous free space
+ *
+ * Gets the location where new data can be written to directly, e.g with read().
+ * The written amount must be then announced with dvb_ring_buffer_commit().
+ *
+ * Return value: pointer to the contiguous free space in @ring
+ */
+guint8 *
+dvb_ring_buffer_write_ptr (DvbRingBuffer *ring, gsize *len)
+{
+	gsize offset = ring->tail & ring->mask;
+
+	*len = MIN (ring->size - offset, dvb_ring_buffer_space (ring));
+
+	return ring->data + offset;
+}
+
+/**
+ * dvb_ring_buffer_commit:
+ * @ring: a #DvbRingBuffer
+ * @len: amount of bytes written to the location given by dvb_ring_buffer_write_ptr()
+ *
+ * Makes @len freshly written bytes available for reading.
+ */
+void
+dvb_ring_buffer_commit (DvbRingBuffer *ring, gsize len)
+{
+	g_assert (len <= dvb_ring_buffer_space (ring));
+
+	ring->tail += len;
+}
+
+/**
+ * dvb_ring_buffer_peek:
+ * @ring: a #DvbRingBuffer
+ * @len: amount of bytes to look at, at most #DVB_PES_PACKET_MAX_SIZE
+ *
+ * Gets a contiguous view of the first @len bytes of @ring without consuming
+ * them. If the bytes wrap around the end of the ring, only the wrapped part
+ * is mirrored after the end of the storage, so the common case of a packet
+ * that doesn't wrap costs no copying at all.
+ *
+ * Return value: pointer to the data, or %NULL if @ring holds less than @len bytes
+ */
+guint8 *
+dvb_ring_buffer_peek (DvbRingBuffer *ring, gsize len)
+{
+	gsize offset = ring->head & ring->mask;
+
+	g_return_val_if_fail (len <= DVB_PES_PACKET_MAX_SIZE, NULL);
+
+	if (len > dvb_ring_buffer_length (ring))
+		return NULL;
+
+	if (offset + len > ring->size)
+		memcpy (ring->data + ring->size, ring->data, offset + len - ring->size);
+
+	return ring->data + offset;
+}
+
+/**
+ * dvb_ring_buffer_consume:
+ * @ring: a #DvbRingBuffer
+ * @len: amount of bytes to drop from the front
+ *
+ * Marks @len bytes at the read position as consumed.
+ */
+void
+dvb_ring_buffer_consume (DvbRingBuffer *ring, gsize len)
+{
+	ring->head += MIN (len, dvb_ring_buffer_length (ring));
+}
@@ -0,0 +1,63 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DVB_RING_BUFFER_H_
+#define _DVB_RING_BUFFER_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The largest PES packet possible - 6 header bytes plus a 16-bit PES_packet_length */
+#define DVB_PES_PACKET_MAX_SIZE (6 + 0xFFFF)
+
+/**
+ * DvbRingBuffer:
+ *
+ * A fixed capacity byte ring buffer. The capacity is a power of two, so
+ * positions are plain free running counters masked on access. The storage
+ * is followed by a slack area of #DVB_PES_PACKET_MAX_SIZE bytes, into which
+ * the wrapped part of a packet is mirrored by dvb_ring_buffer_peek(), so
+ * that any packet can be parsed in place as one contiguous memory block.
+ */
+typedef struct _DvbRingBuffer
+{
+	guint8 *data;
+	gsize size;
+	gsize mask;
+
+	gsize head; /* read position */
+	gsize tail; /* write position */
+} DvbRingBuffer;
+
+void     dvb_ring_buffer_init       (DvbRingBuffer *ring, gsize size);
+void     dvb_ring_buffer_clear      (DvbRingBuffer *ring);
+void     dvb_ring_buffer_free       (DvbRingBuffer *ring);
+guint8  *dvb_ring_buffer_write_ptr  (DvbRingBuffer *ring, gsize *len);
+void     dvb_ring_buffer_commit     (DvbRingBuffer *ring, gsize len);
+guint8  *dvb_ring_buffer_peek       (DvbRingBuffer *ring, gsize len);
+void     dvb_ring_buffer_consume    (DvbRingBuffer *ring, gsize len);
+
+#define dvb_ring_buffer_length(ring) ((ring)->tail - (ring)->head)
+#define dvb_ring_buffer_space(ring)  ((ring)->size - dvb_ring_buffer_length (ring))
+
+G_END_DECLS
+
+#endif /* _DVB_RING_BUFFER_H_ */
@@ -0,0 +1,848 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "dvb-simd.h"
+#include <string.h>             /* memcpy */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DVB_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * SECTION:dvb-simd
+ * @short_description: vectorized scanning and pixel routines
+ * @stability: Private
+ *
+ * Hot loops that benefit from SIMD instructions. Every routine has a plain C
+ * implementation, and on x86 also SSE2, SSSE3, SSE4.1 or AVX2 ones, compiled with target
+ * attributes so that the rest of the library needs no special compiler flags.
+ * The best implementation the CPU supports is picked on first use.
+ */
+
+typedef gint (*DvbFindStartCodeFunc) (const guint8 *data, gint len);
+
+/* The packet_start_code_prefix followed by the private_stream_1 stream_id */
+#define DVB_PES_START_CODE_MATCHES(p) \
+	((p)[0] == 0x00 && (p)[1] == 0x00 && (p)[2] == 0x01 && (p)[3] == 0xBD)
+
+static gint
+find_start_code_c (const guint8 *data, gint len)
+{
+	gint i;
+
+	/* Test the 0x01 first - zero bytes are common in subtitle data */
+	for (i = 0; i + 4 <= len; ++i) {
+		if (data[i + 2] == 0x01 && DVB_PES_START_CODE_MATCHES (data + i))
+			return i;
+	}
+
+	return -1;
+}
+
+#ifdef DVB_SIMD_X86
+/* Compares the four byte positions of a start code at once for 16 (or 32)
+ * candidate offsets, using unaligned loads shifted by one byte each */
+__attribute__ ((target ("sse2")))
+static gint
+find_start_code_sse2 (const guint8 *data, gint len)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i one = _mm_set1_epi8 (0x01);
+	const __m128i stream_id = _mm_set1_epi8 ((char) 0xBD);
+	__m128i match;
+	guint mask;
+	gint i, tail;
+
+	for (i = 0; i + 16 + 3 <= len; i += 16) {
+		match = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (data + i + 2)), one);
+		if (!_mm_movemask_epi8 (match))
+			continue;
+
+		match = _mm_and_si128 (match, _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (data + i)), zero));
+		match = _mm_and_si128 (match, _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (data + i + 1)), zero));
+		match = _mm_and_si128 (match, _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (data + i + 3)), stream_id));
+		mask = _mm_movemask_epi8 (match);
+		if (mask)
+			return i + __builtin_ctz (mask);
+	}
+
+	tail = find_start_code_c (data + i, len - i);
+	return tail < 0 ? -1 : i + tail;
+}
+
+__attribute__ ((target ("avx2")))
+static gint
+find_start_code_avx2 (const guint8 *data, gint len)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	const __m256i one = _mm256_set1_epi8 (0x01);
+	const __m256i stream_id = _mm256_set1_epi8 ((char) 0xBD);
+	__m256i match;
+	guint mask;
+	gint i, tail;
+
+	for (i = 0; i + 32 + 3 <= len; i += 32) {
+		match = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (data + i + 2)), one);
+		if (!_mm256_movemask_epi8 (match))
+			continue;
+
+		match = _mm256_and_si256 (match, _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (data + i)), zero));
+		match = _mm256_and_si256 (match, _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (data + i + 1)), zero));
+		match = _mm256_and_si256 (match, _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (data + i + 3)), stream_id));
+		mask = _mm256_movemask_epi8 (match);
+		if (mask)
+			return i + __builtin_ctz (mask);
+	}
+
+	tail = find_start_code_sse2 (data + i, len - i);
+	return tail < 0 ? -1 : i + tail;
+}
+#endif
+
+static DvbFindStartCodeFunc
+find_start_code_resolve (void)
+{
+#ifdef DVB_SIMD_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2"))
+		return find_start_code_avx2;
+	if (__builtin_cpu_supports ("sse2"))
+		return find_start_code_sse2;
+#endif
+	return find_start_code_c;
+}
+
+/**
+ * dvb_pes_find_start_code:
+ * @data: the data to search
+ * @len: length of @data
+ *
+ * Finds the first start of a private_stream_1 PES packet, i.e the bytes
+ * 0x00 0x00 0x01 0xBD, in @data. Used to regain sync in a PES stream after
+ * corrupted or cut data, in place of trying every byte position in turn.
+ *
+ * Return value: the offset of the start code, or -1 if @data holds none. The
+ * last three bytes may still be the beginning of one in the latter case.
+ */
+gint
+dvb_pes_find_start_code (const guint8 *data, gint len)
+{
+	/* Resolving more than once in racing threads is harmless */
+	static DvbFindStartCodeFunc find_start_code = NULL;
+
+	if (G_UNLIKELY (!find_start_code))
+		find_start_code = find_start_code_resolve ();
+
+	return find_start_code (data, len);
+}
+
+typedef gboolean (*DvbFindOpaqueSpanFunc) (const guint8 *row, gint len, const guint8 *opaque, guint8 depth, gint *first, gint *last);
+
+static gboolean
+find_opaque_span_c (const guint8 *row, gint len, const guint8 *opaque, guint8 depth, gint *first, gint *last)
+{
+	gint i, j;
+
+	for (i = 0; i < len && !opaque[row[i]]; i++);
+	if (i == len)
+		return FALSE;
+
+	for (j = len - 1; !opaque[row[j]]; j--);
+
+	*first = i;
+	*last = j;
+	return TRUE;
+}
+
+#ifdef DVB_SIMD_X86
+/* Returns a bit mask of the opaque pixels among 16, looking them up in
+ * the first 16 entries of opaque with a byte shuffle. Pixels above 15
+ * can't be looked up that way and are looked up one by one */
+__attribute__ ((target ("ssse3")))
+static inline guint
+opaque_mask_ssse3 (const guint8 *pixels, __m128i lut, const guint8 *opaque)
+{
+	const __m128i fifteen = _mm_set1_epi8 (15);
+	__m128i v = _mm_loadu_si128 ((const __m128i *) pixels);
+	guint mask, large;
+	gint i;
+
+	mask = _mm_movemask_epi8 (_mm_shuffle_epi8 (lut, v));
+	large = ~_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_subs_epu8 (v, fifteen), _mm_setzero_si128 ())) & 0xffff;
+
+	while (G_UNLIKELY (large)) {
+		i = __builtin_ctz (large);
+		large &= large - 1;
+		mask = (mask & ~(1U << i)) | ((opaque[pixels[i]] ? 1U : 0) << i);
+	}
+
+	return mask;
+}
+
+__attribute__ ((target ("ssse3")))
+static gboolean
+find_opaque_span_ssse3 (const guint8 *row, gint len, const guint8 *opaque, guint8 depth, gint *first, gint *last)
+{
+	__m128i lut;
+	guint mask;
+	gint i, j, end, tail_first, tail_last;
+
+	/* Only regions of up to 16 colours have all their pixels in the table */
+	if (depth > 4)
+		return find_opaque_span_c (row, len, opaque, depth, first, last);
+
+	lut = _mm_loadu_si128 ((const __m128i *) opaque);
+	end = len & ~15;
+
+	for (i = 0; i < end; i += 16) {
+		mask = opaque_mask_ssse3 (row + i, lut, opaque);
+		if (mask)
+			break;
+	}
+
+	if (i == end) {
+		/* Nothing opaque in the full blocks, so it's all up to the tail */
+		if (!find_opaque_span_c (row + end, len - end, opaque, depth, &tail_first, &tail_last))
+			return FALSE;
+		*first = end + tail_first;
+		*last = end + tail_last;
+		return TRUE;
+	}
+	*first = i + __builtin_ctz (mask);
+
+	if (find_opaque_span_c (row + end, len - end, opaque, depth, &tail_first, &tail_last)) {
+		*last = end + tail_last;
+		return TRUE;
+	}
+
+	for (j = end - 16; j > i; j -= 16) {
+		mask = opaque_mask_ssse3 (row + j, lut, opaque);
+		if (mask)
+			break;
+	}
+	if (j == i)
+		mask = opaque_mask_ssse3 (row + j, lut, opaque);
+	*last = j + 31 - __builtin_clz (mask);
+
+	return TRUE;
+}
+#endif
+
+static DvbFindOpaqueSpanFunc
+find_opaque_span_resolve (void)
+{
+#ifdef DVB_SIMD_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("ssse3"))
+		return find_opaque_span_ssse3;
+#endif
+	return find_opaque_span_c;
+}
+
+/**
+ * dvb_pixels_find_opaque_span:
+ * @row: a row of palette indices
+ * @len: the number of pixels in @row
+ * @opaque: 256 bytes, non-zero for the palette indices that aren't fully
+ *   transparent. For @depth up to 4 they must be 0 or 0xff.
+ * @depth: the bit depth of the region @row belongs to
+ * @first: return location for the first opaque pixel
+ * @last: return location for the last opaque pixel
+ *
+ * Finds the span of @row between its first and last pixel that isn't fully
+ * transparent, for trimming transparent borders off subtitle rectangles.
+ *
+ * Return value: %FALSE if all of @row is transparent
+ */
+gboolean
+dvb_pixels_find_opaque_span (const guint8 *row, gint len, const guint8 *opaque, guint8 depth, gint *first, gint *last)
+{
+	/* Resolving more than once in racing threads is harmless */
+	static DvbFindOpaqueSpanFunc find_opaque_span = NULL;
+
+	if (G_UNLIKELY (!find_opaque_span))
+		find_opaque_span = find_opaque_span_resolve ();
+
+	return find_opaque_span (row, len, opaque, depth, first, last);
+}
+
+typedef void (*DvbExpandPaletteFunc) (const guint8 *src, guint32 *dst, gint len, const guint32 *palette, guint8 depth);
+
+static void
+expand_palette_c (const guint8 *src, guint32 *dst, gint len, const guint32 *palette, guint8 depth)
+{
+	gint i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = palette[src[i]];
+}
+
+#ifdef DVB_SIMD_X86
+/* Splits the first 16 palette entries into one table per byte, so that a
+ * byte shuffle looks up that byte of 16 pixels at once */
+__attribute__ ((target ("ssse3")))
+static inline void
+split_palette_ssse3 (const guint32 *palette, __m128i planes[4])
+{
+	const __m128i gather_bytes = _mm_setr_epi8 (0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+	__m128i p0, p1, p2, p3, lo, hi;
+
+	p0 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) palette), gather_bytes);
+	p1 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (palette + 4)), gather_bytes);
+	p2 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (palette + 8)), gather_bytes);
+	p3 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (palette + 12)), gather_bytes);
+
+	/* Transpose the 4x4 matrix of 32-bit groups */
+	lo = _mm_unpacklo_epi32 (p0, p1);
+	hi = _mm_unpacklo_epi32 (p2, p3);
+	planes[0] = _mm_unpacklo_epi64 (lo, hi);
+	planes[1] = _mm_unpackhi_epi64 (lo, hi);
+	lo = _mm_unpackhi_epi32 (p0, p1);
+	hi = _mm_unpackhi_epi32 (p2, p3);
+	planes[2] = _mm_unpacklo_epi64 (lo, hi);
+	planes[3] = _mm_unpackhi_epi64 (lo, hi);
+}
+
+/* Pixel values above 15 don't occur in regions of up to 16 colours, unless
+ * left over from an earlier region depth. Looks those up one by one */
+static inline void
+fix_large_indices (const guint8 *src, guint32 *dst, guint large, const guint32 *palette)
+{
+	gint i;
+
+	while (G_UNLIKELY (large)) {
+		i = __builtin_ctz (large);
+		large &= large - 1;
+		dst[i] = palette[src[i]];
+	}
+}
+
+__attribute__ ((target ("ssse3")))
+static void
+expand_palette_ssse3 (const guint8 *src, guint32 *dst, gint len, const guint32 *palette, guint8 depth)
+{
+	const __m128i fifteen = _mm_set1_epi8 (15);
+	__m128i planes[4], v, b0, b1, b2, b3, lo, hi;
+	guint large;
+	gint i;
+
+	if (depth > 4) {
+		expand_palette_c (src, dst, len, palette, depth);
+		return;
+	}
+
+	split_palette_ssse3 (palette, planes);
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128 ((const __m128i *) (src + i));
+		b0 = _mm_shuffle_epi8 (planes[0], v);
+		b1 = _mm_shuffle_epi8 (planes[1], v);
+		b2 = _mm_shuffle_epi8 (planes[2], v);
+		b3 = _mm_shuffle_epi8 (planes[3], v);
+
+		lo = _mm_unpacklo_epi8 (b0, b1);
+		hi = _mm_unpacklo_epi8 (b2, b3);
+		_mm_storeu_si128 ((__m128i *) (dst + i), _mm_unpacklo_epi16 (lo, hi));
+		_mm_storeu_si128 ((__m128i *) (dst + i + 4), _mm_unpackhi_epi16 (lo, hi));
+		lo = _mm_unpackhi_epi8 (b0, b1);
+		hi = _mm_unpackhi_epi8 (b2, b3);
+		_mm_storeu_si128 ((__m128i *) (dst + i + 8), _mm_unpacklo_epi16 (lo, hi));
+		_mm_storeu_si128 ((__m128i *) (dst + i + 12), _mm_unpackhi_epi16 (lo, hi));
+
+		large = ~_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_subs_epu8 (v, fifteen), _mm_setzero_si128 ())) & 0xffff;
+		fix_large_indices (src + i, dst + i, large, palette);
+	}
+
+	expand_palette_c (src + i, dst + i, len - i, palette, depth);
+}
+
+/* As the SSSE3 version for up to 16 colours, 32 pixels at a time. 8-bit
+ * pixels are looked up with gathers, 8 at a time */
+__attribute__ ((target ("avx2")))
+static void
+expand_palette_avx2 (const guint8 *src, guint32 *dst, gint len, const guint32 *palette, guint8 depth)
+{
+	const __m256i fifteen = _mm256_set1_epi8 (15);
+	__m128i planes128[4];
+	__m256i planes[4], v, b0, b1, b2, b3, lo01, hi01, lo23, hi23, p0, p1, p2, p3;
+	guint large;
+	gint i, k;
+
+	if (depth > 4) {
+		for (i = 0; i + 8 <= len; i += 8) {
+			v = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *) (src + i)));
+			_mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_i32gather_epi32 ((const int *) palette, v, 4));
+		}
+		expand_palette_c (src + i, dst + i, len - i, palette, depth);
+		return;
+	}
+
+	split_palette_ssse3 (palette, planes128);
+	for (k = 0; k < 4; k++)
+		planes[k] = _mm256_broadcastsi128_si256 (planes128[k]);
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = _mm256_loadu_si256 ((const __m256i *) (src + i));
+		b0 = _mm256_shuffle_epi8 (planes[0], v);
+		b1 = _mm256_shuffle_epi8 (planes[1], v);
+		b2 = _mm256_shuffle_epi8 (planes[2], v);
+		b3 = _mm256_shuffle_epi8 (planes[3], v);
+
+		/* The unpacks work within each 128-bit lane, so the pixels come
+		 * out as 0-3|16-19, 4-7|20-23, 8-11|24-27 and 12-15|28-31 */
+		lo01 = _mm256_unpacklo_epi8 (b0, b1);
+		hi01 = _mm256_unpackhi_epi8 (b0, b1);
+		lo23 = _mm256_unpacklo_epi8 (b2, b3);
+		hi23 = _mm256_unpackhi_epi8 (b2, b3);
+		p0 = _mm256_unpacklo_epi16 (lo01, lo23);
+		p1 = _mm256_unpackhi_epi16 (lo01, lo23);
+		p2 = _mm256_unpacklo_epi16 (hi01, hi23);
+		p3 = _mm256_unpackhi_epi16 (hi01, hi23);
+		_mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_permute2x128_si256 (p0, p1, 0x20));
+		_mm256_storeu_si256 ((__m256i *) (dst + i + 8), _mm256_permute2x128_si256 (p2, p3, 0x20));
+		_mm256_storeu_si256 ((__m256i *) (dst + i + 16), _mm256_permute2x128_si256 (p0, p1, 0x31));
+		_mm256_storeu_si256 ((__m256i *) (dst + i + 24), _mm256_permute2x128_si256 (p2, p3, 0x31));
+
+		large = ~_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (_mm256_subs_epu8 (v, fifteen), _mm256_setzero_si256 ()));
+		fix_large_indices (src + i, dst + i, large, palette);
+	}
+
+	expand_palette_ssse3 (src + i, dst + i, len - i, palette, depth);
+}
+#endif
+
+static DvbExpandPaletteFunc
+expand_palette_resolve (void)
+{
+#ifdef DVB_SIMD_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2"))
+		return expand_palette_avx2;
+	if (__builtin_cpu_supports ("ssse3"))
+		return expand_palette_ssse3;
+#endif
+	return expand_palette_c;
+}
+
+/**
+ * dvb_pixels_expand_palette:
+ * @src: a row of palette indices
+ * @dst: return location for @len pixels
+ * @len: the number of pixels in @src
+ * @palette: 256 palette entries, already in the pixel format wanted in @dst
+ * @depth: the bit depth of the region @src belongs to
+ *
+ * Looks up the colours of @len pixels in @palette.
+ */
+void
+dvb_pixels_expand_palette (const guint8 *src, guint32 *dst, gint len, const guint32 *palette, guint8 depth)
+{
+	/* Resolving more than once in racing threads is harmless */
+	static DvbExpandPaletteFunc expand_palette = NULL;
+
+	if (G_UNLIKELY (!expand_palette))
+		expand_palette = expand_palette_resolve ();
+
+	expand_palette (src, dst, len, palette, depth);
+}
+
+/* Blending uses alpha scaled to 0-256, so that (s * a + d * (256 - a)) >> 8
+ * is exact for fully transparent and fully opaque pixels and fits 16 bits */
+#define DVB_BLEND_ALPHA(a) ((a) + ((a) >> 7))
+#define DVB_BLEND(s, d, a) (((s) * (a) + (d) * (256 - (a)) + 128) >> 8)
+
+typedef void (*DvbBlendLumaFunc) (guint8 *dst, const guint32 *ayuv, gint len);
+typedef void (*DvbBlendChromaFunc) (guint8 *dst_u, guint8 *dst_v, const guint32 *top, const guint32 *bottom, gint len);
+typedef void (*DvbBlendPackedFunc) (guint8 *dst, const guint32 *src, gint len, gint alpha_byte);
+
+static void
+blend_luma_c (guint8 *dst, const guint32 *ayuv, gint len)
+{
+	guint a;
+	gint i;
+
+	for (i = 0; i < len; i++) {
+		a = DVB_BLEND_ALPHA (ayuv[i] >> 24);
+		if (a)
+			dst[i] = DVB_BLEND ((ayuv[i] >> 16) & 0xff, dst[i], a);
+	}
+}
+
+/* Each chroma sample gets the alpha weighted average of the chroma of its
+ * 2x2 pixels, blended with their average alpha */
+static void
+blend_chroma_420_c (guint8 *dst_u, guint8 *dst_v, const guint32 *top, const guint32 *bottom, gint len)
+{
+	const guint32 *p[4];
+	guint a, sa, su, sv;
+	gint i, k, step;
+
+	/* Interleaved UV planes come as dst_v == NULL */
+	step = dst_v ? 1 : 2;
+	if (!dst_v)
+		dst_v = dst_u + 1;
+
+	for (i = 0; i < len; i++) {
+		p[0] = top + 2 * i;
+		p[1] = top + 2 * i + 1;
+		p[2] = bottom + 2 * i;
+		p[3] = bottom + 2 * i + 1;
+
+		sa = su = sv = 0;
+		for (k = 0; k < 4; k++) {
+			a = DVB_BLEND_ALPHA (*p[k] >> 24);
+			sa += a;
+			su += ((*p[k] >> 8) & 0xff) * a;
+			sv += (*p[k] & 0xff) * a;
+		}
+		if (!sa)
+			continue;
+
+		dst_u[i * step] = (su + dst_u[i * step] * (1024 - sa) + 512) >> 10;
+		dst_v[i * step] = (sv + dst_v[i * step] * (1024 - sa) + 512) >> 10;
+	}
+}
+
+static void
+blend_packed_c (guint8 *dst, const guint32 *src, gint len, gint alpha_byte)
+{
+	const guint8 *s;
+	guint a;
+	gint i, k;
+
+	for (i = 0; i < len; i++, dst += 4) {
+		s = (const guint8 *) (src + i);
+		a = DVB_BLEND_ALPHA (s[alpha_byte]);
+		if (!a)
+			continue;
+		/* The alpha byte of the frame is composited over with 255 */
+		for (k = 0; k < 4; k++)
+			dst[k] = DVB_BLEND (k == alpha_byte ? 255 : s[k], dst[k], a);
+	}
+}
+
+#ifdef DVB_SIMD_X86
+/* Blends 8 (or 16) pixels of 16-bit source values s into d with 16-bit
+ * alphas a of 0-255 */
+__attribute__ ((target ("sse4.1")))
+static inline __m128i
+blend_epi16_sse41 (__m128i s, __m128i d, __m128i a)
+{
+	a = _mm_add_epi16 (a, _mm_srli_epi16 (a, 7));
+	s = _mm_add_epi16 (_mm_mullo_epi16 (s, a), _mm_mullo_epi16 (d, _mm_sub_epi16 (_mm_set1_epi16 (256), a)));
+	return _mm_srli_epi16 (_mm_add_epi16 (s, _mm_set1_epi16 (128)), 8);
+}
+
+__attribute__ ((target ("avx2")))
+static inline __m256i
+blend_epi16_avx2 (__m256i s, __m256i d, __m256i a)
+{
+	a = _mm256_add_epi16 (a, _mm256_srli_epi16 (a, 7));
+	s = _mm256_add_epi16 (_mm256_mullo_epi16 (s, a), _mm256_mullo_epi16 (d, _mm256_sub_epi16 (_mm256_set1_epi16 (256), a)));
+	return _mm256_srli_epi16 (_mm256_add_epi16 (s, _mm256_set1_epi16 (128)), 8);
+}
+
+__attribute__ ((target ("sse4.1")))
+static void
+blend_luma_sse41 (guint8 *dst, const guint32 *ayuv, gint len)
+{
+	const __m128i byte_mask = _mm_set1_epi32 (0xff);
+	__m128i p0, p1, a, y, d;
+	gint i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		p0 = _mm_loadu_si128 ((const __m128i *) (ayuv + i));
+		p1 = _mm_loadu_si128 ((const __m128i *) (ayuv + i + 4));
+		a = _mm_packus_epi32 (_mm_srli_epi32 (p0, 24), _mm_srli_epi32 (p1, 24));
+		if (_mm_testz_si128 (a, a))
+			continue;
+
+		y = _mm_packus_epi32 (_mm_and_si128 (_mm_srli_epi32 (p0, 16), byte_mask),
+				      _mm_and_si128 (_mm_srli_epi32 (p1, 16), byte_mask));
+		d = _mm_cvtepu8_epi16 (_mm_loadl_epi64 ((const __m128i *) (dst + i)));
+		d = blend_epi16_sse41 (y, d, a);
+		_mm_storel_epi64 ((__m128i *) (dst + i), _mm_packus_epi16 (d, d));
+	}
+
+	blend_luma_c (dst + i, ayuv + i, len - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+blend_luma_avx2 (guint8 *dst, const guint32 *ayuv, gint len)
+{
+	const __m256i byte_mask = _mm256_set1_epi32 (0xff);
+	__m256i p0, p1, a, y, d;
+	gint i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		p0 = _mm256_loadu_si256 ((const __m256i *) (ayuv + i));
+		p1 = _mm256_loadu_si256 ((const __m256i *) (ayuv + i + 8));
+		/* The packs work within each 128-bit lane, so put the groups of
+		 * four pixels back in order after them */
+		a = _mm256_packus_epi32 (_mm256_srli_epi32 (p0, 24), _mm256_srli_epi32 (p1, 24));
+		if (_mm256_testz_si256 (a, a))
+			continue;
+		a = _mm256_permute4x64_epi64 (a, 0xd8);
+
+		y = _mm256_packus_epi32 (_mm256_and_si256 (_mm256_srli_epi32 (p0, 16), byte_mask),
+					 _mm256_and_si256 (_mm256_srli_epi32 (p1, 16), byte_mask));
+		y = _mm256_permute4x64_epi64 (y, 0xd8);
+		d = _mm256_cvtepu8_epi16 (_mm_loadu_si128 ((const __m128i *) (dst + i)));
+		d = blend_epi16_avx2 (y, d, a);
+		d = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (d, d), 0xd8);
+		_mm_storeu_si128 ((__m128i *) (dst + i), _mm256_castsi256_si128 (d));
+	}
+
+	blend_luma_sse41 (dst + i, ayuv + i, len - i);
+}
+
+/* Sums the scaled alphas, and the U and V values weighted by them, of the
+ * pixel pairs of 8 pixels */
+__attribute__ ((target ("sse4.1")))
+static inline void
+sum_chroma_pairs_sse41 (const guint32 *pixels, __m128i *sa, __m128i *su, __m128i *sv)
+{
+	const __m128i byte_mask = _mm_set1_epi32 (0xff);
+	__m128i p0, p1, a0, a1;
+
+	p0 = _mm_loadu_si128 ((const __m128i *) pixels);
+	p1 = _mm_loadu_si128 ((const __m128i *) (pixels + 4));
+	a0 = _mm_srli_epi32 (p0, 24);
+	a0 = _mm_add_epi32 (a0, _mm_srli_epi32 (a0, 7));
+	a1 = _mm_srli_epi32 (p1, 24);
+	a1 = _mm_add_epi32 (a1, _mm_srli_epi32 (a1, 7));
+
+	*sa = _mm_add_epi32 (*sa, _mm_hadd_epi32 (a0, a1));
+	*su = _mm_add_epi32 (*su, _mm_hadd_epi32 (_mm_mullo_epi32 (_mm_and_si128 (_mm_srli_epi32 (p0, 8), byte_mask), a0),
+						  _mm_mullo_epi32 (_mm_and_si128 (_mm_srli_epi32 (p1, 8), byte_mask), a1)));
+	*sv = _mm_add_epi32 (*sv, _mm_hadd_epi32 (_mm_mullo_epi32 (_mm_and_si128 (p0, byte_mask), a0),
+						  _mm_mullo_epi32 (_mm_and_si128 (p1, byte_mask), a1)));
+}
+
+/* Chroma is a quarter of the pixels, so this has no AVX2 version */
+__attribute__ ((target ("sse4.1")))
+static void
+blend_chroma_420_sse41 (guint8 *dst_u, guint8 *dst_v, const guint32 *top, const guint32 *bottom, gint len)
+{
+	const __m128i split_uv = _mm_setr_epi8 (0, 2, 4, 6, 1, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i merge_uv = _mm_setr_epi8 (0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+	__m128i sa, su, sv, du, dv, inv, uv;
+	guint32 u4, v4;
+	gint i;
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		sa = su = sv = _mm_setzero_si128 ();
+		sum_chroma_pairs_sse41 (top + 2 * i, &sa, &su, &sv);
+		sum_chroma_pairs_sse41 (bottom + 2 * i, &sa, &su, &sv);
+		if (_mm_testz_si128 (sa, sa))
+			continue;
+
+		if (dst_v) {
+			memcpy (&u4, dst_u + i, 4);
+			memcpy (&v4, dst_v + i, 4);
+			du = _mm_cvtepu8_epi32 (_mm_cvtsi32_si128 (u4));
+			dv = _mm_cvtepu8_epi32 (_mm_cvtsi32_si128 (v4));
+		} else {
+			uv = _mm_shuffle_epi8 (_mm_loadl_epi64 ((const __m128i *) (dst_u + 2 * i)), split_uv);
+			du = _mm_cvtepu8_epi32 (uv);
+			dv = _mm_cvtepu8_epi32 (_mm_srli_si128 (uv, 4));
+		}
+
+		inv = _mm_sub_epi32 (_mm_set1_epi32 (1024), sa);
+		du = _mm_srli_epi32 (_mm_add_epi32 (_mm_add_epi32 (su, _mm_mullo_epi32 (du, inv)), _mm_set1_epi32 (512)), 10);
+		dv = _mm_srli_epi32 (_mm_add_epi32 (_mm_add_epi32 (sv, _mm_mullo_epi32 (dv, inv)), _mm_set1_epi32 (512)), 10);
+		uv = _mm_packus_epi32 (du, dv);
+		uv = _mm_packus_epi16 (uv, uv);
+
+		if (dst_v) {
+			u4 = _mm_cvtsi128_si32 (uv);
+			v4 = _mm_cvtsi128_si32 (_mm_srli_si128 (uv, 4));
+			memcpy (dst_u + i, &u4, 4);
+			memcpy (dst_v + i, &v4, 4);
+		} else {
+			_mm_storel_epi64 ((__m128i *) (dst_u + 2 * i), _mm_shuffle_epi8 (uv, merge_uv));
+		}
+	}
+
+	blend_chroma_420_c (dst_u + (dst_v ? i : 2 * i), dst_v ? dst_v + i : NULL, top + 2 * i, bottom + 2 * i, len - i);
+}
+
+__attribute__ ((target ("sse4.1")))
+static void
+blend_packed_sse41 (guint8 *dst, const guint32 *src, gint len, gint alpha_byte)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	__m128i spread_alpha, alpha_slot, p, a, d;
+	gint i;
+
+	spread_alpha = _mm_add_epi8 (_mm_set1_epi8 (alpha_byte),
+				     _mm_setr_epi8 (0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12));
+	alpha_slot = _mm_set1_epi32 ((gint) (0xffU << (8 * alpha_byte)));
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		p = _mm_loadu_si128 ((const __m128i *) (src + i));
+		a = _mm_shuffle_epi8 (p, spread_alpha);
+		if (_mm_testz_si128 (a, a))
+			continue;
+		p = _mm_or_si128 (p, alpha_slot);
+		d = _mm_loadu_si128 ((const __m128i *) (dst + 4 * i));
+
+		d = _mm_packus_epi16 (blend_epi16_sse41 (_mm_cvtepu8_epi16 (p), _mm_cvtepu8_epi16 (d), _mm_cvtepu8_epi16 (a)),
+				      blend_epi16_sse41 (_mm_unpackhi_epi8 (p, zero), _mm_unpackhi_epi8 (d, zero), _mm_unpackhi_epi8 (a, zero)));
+		_mm_storeu_si128 ((__m128i *) (dst + 4 * i), d);
+	}
+
+	blend_packed_c (dst + 4 * i, src + i, len - i, alpha_byte);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+blend_packed_avx2 (guint8 *dst, const guint32 *src, gint len, gint alpha_byte)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	__m256i spread_alpha, alpha_slot, p, a, d;
+	gint i;
+
+	spread_alpha = _mm256_add_epi8 (_mm256_set1_epi8 (alpha_byte),
+					_mm256_setr_epi8 (0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12,
+							  0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12));
+	alpha_slot = _mm256_set1_epi32 ((gint) (0xffU << (8 * alpha_byte)));
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		p = _mm256_loadu_si256 ((const __m256i *) (src + i));
+		a = _mm256_shuffle_epi8 (p, spread_alpha);
+		if (_mm256_testz_si256 (a, a))
+			continue;
+		p = _mm256_or_si256 (p, alpha_slot);
+		d = _mm256_loadu_si256 ((const __m256i *) (dst + 4 * i));
+
+		/* Unpacking and packing within the lanes keeps the byte order */
+		d = _mm256_packus_epi16 (blend_epi16_avx2 (_mm256_unpacklo_epi8 (p, zero), _mm256_unpacklo_epi8 (d, zero), _mm256_unpacklo_epi8 (a, zero)),
+					 blend_epi16_avx2 (_mm256_unpackhi_epi8 (p, zero), _mm256_unpackhi_epi8 (d, zero), _mm256_unpackhi_epi8 (a, zero)));
+		_mm256_storeu_si256 ((__m256i *) (dst + 4 * i), d);
+	}
+
+	blend_packed_sse41 (dst + 4 * i, src + i, len - i, alpha_byte);
+}
+#endif
+
+static DvbBlendLumaFunc
+blend_luma_resolve (void)
+{
+#ifdef DVB_SIMD_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2"))
+		return blend_luma_avx2;
+	if (__builtin_cpu_supports ("sse4.1"))
+		return blend_luma_sse41;
+#endif
+	return blend_luma_c;
+}
+
+static DvbBlendChromaFunc
+blend_chroma_420_resolve (void)
+{
+#ifdef DVB_SIMD_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse4.1"))
+		return blend_chroma_420_sse41;
+#endif
+	return blend_chroma_420_c;
+}
+
+static DvbBlendPackedFunc
+blend_packed_resolve (void)
+{
+#ifdef DVB_SIMD_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2"))
+		return blend_packed_avx2;
+	if (__builtin_cpu_supports ("sse4.1"))
+		return blend_packed_sse41;
+#endif
+	return blend_packed_c;
+}
+
+/**
+ * dvb_pixels_blend_luma:
+ * @dst: a row of a luma plane
+ * @ayuv: @len pixels, each 0xAAYYUUVV
+ * @len: the number of pixels
+ *
+ * Alpha blends the luma of @ayuv onto @dst.
+ */
+void
+dvb_pixels_blend_luma (guint8 *dst, const guint32 *ayuv, gint len)
+{
+	/* Resolving more than once in racing threads is harmless */
+	static DvbBlendLumaFunc blend_luma = NULL;
+
+	if (G_UNLIKELY (!blend_luma))
+		blend_luma = blend_luma_resolve ();
+
+	blend_luma (dst, ayuv, len);
+}
+
+/**
+ * dvb_pixels_blend_chroma_420:
+ * @dst_u: a row of a Cb plane, or of an interleaved CbCr plane
+ * @dst_v: a row of a Cr plane, or %NULL if @dst_u is interleaved
+ * @top: 2 * @len pixels of the upper luma row, each 0xAAYYUUVV
+ * @bottom: 2 * @len pixels of the lower luma row
+ * @len: the number of chroma samples
+ *
+ * Alpha blends the chroma of the 2x2 pixel blocks of @top and @bottom onto
+ * @len chroma samples of a 4:2:0 subsampled frame. Pixels outside of the
+ * subtitles should be passed with an alpha of 0.
+ */
+void
+dvb_pixels_blend_chroma_420 (guint8 *dst_u, guint8 *dst_v, const guint32 *top, const guint32 *bottom, gint len)
+{
+	static DvbBlendChromaFunc blend_chroma_420 = NULL;
+
+	if (G_UNLIKELY (!blend_chroma_420))
+		blend_chroma_420 = blend_chroma_420_resolve ();
+
+	blend_chroma_420 (dst_u, dst_v, top, bottom, len);
+}
+
+/**
+ * dvb_pixels_blend_packed:
+ * @dst: a row of a frame with 4 bytes per pixel
+ * @src: @len pixels, in the byte order of @dst
+ * @len: the number of pixels
+ * @alpha_byte: the offset of the alpha byte within the pixels of @src, and of
+ *   the alpha or padding byte of @dst, 0 or 3
+ *
+ * Alpha blends @src onto @dst. The alpha bytes of @dst are composited over,
+ * so they stay opaque if they were.
+ */
+void
+dvb_pixels_blend_packed (guint8 *dst, const guint32 *src, gint len, gint alpha_byte)
+{
+	static DvbBlendPackedFunc blend_packed = NULL;
+
+	if (G_UNLIKELY (!blend_packed))
+		blend_packed = blend_packed_resolve ();
+
+	blend_packed (dst, src, len, alpha_byte);
+}
@@ -0,0 +1,37 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DVB_SIMD_H_
+#define _DVB_SIMD_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gint     dvb_pes_find_start_code    (const guint8 *data, gint len);
+gboolean dvb_pixels_find_opaque_span (const guint8 *row, gint len, const guint8 *opaque, guint8 depth, gint *first, gint *last);
+void     dvb_pixels_expand_palette  (const guint8 *src, guint32 *dst, gint len, const guint32 *palette, guint8 depth);
+void     dvb_pixels_blend_luma      (guint8 *dst, const guint32 *ayuv, gint len);
+void     dvb_pixels_blend_chroma_420 (guint8 *dst_u, guint8 *dst_v, const guint32 *top, const guint32 *bottom, gint len);
+void     dvb_pixels_blend_packed    (guint8 *dst, const guint32 *src, gint len, gint alpha_byte);
+
+G_END_DECLS
+
+#endif /* _DVB_SIMD_H_ */
@@ -0,0 +1,273 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "dvb-sub-blend.h"
+#include <string.h>             /* memset */
+#include "dvb-color.h"
+#include "dvb-simd.h"
+
+/**
+ * SECTION:dvb-sub-blend
+ * @short_description: burning subtitles into video frames
+ * @stability: Unstable
+ *
+ * dvb_subtitles_blend() alpha blends all rects of a #DVBSubtitles onto a
+ * video frame in memory provided by the caller, for burning subtitles into
+ * video without a separate renderer. It works on I420 and NV12 frames, and
+ * on 24 and 32-bit packed RGB frames. Each row of a rect gets its colours
+ * looked up in its palette and is blended onto the frame with vectorized
+ * code, so that no pixel is converted between RGB and YUV.
+ *
+ * The rects are placed at their coordinates as they are, and clipped to the
+ * frame. Frames of a different size than the display definition of the
+ * subtitles have to be scaled to it by the caller.
+ */
+
+/* Byte offsets of the colours within the pixels of packed formats */
+typedef struct
+{
+  gint bpp;
+  gint r, g, b, a;
+} DvbSubPackedLayout;
+
+static const DvbSubPackedLayout packed_layouts[] = {
+  /* RGBA */ {4, 0, 1, 2, 3},
+  /* BGRA */ {4, 2, 1, 0, 3},
+  /* ARGB */ {4, 1, 2, 3, 0},
+  /* ABGR */ {4, 3, 2, 1, 0},
+  /* RGB */ {3, 0, 1, 2, -1},
+  /* BGR */ {3, 2, 1, 0, -1}
+};
+
+/* Fills palette with the colours of rect in the form the blending routines
+ * for frame take */
+static void
+_dvb_sub_blend_prepare_palette (const DVBSubtitleRect * rect,
+    const DvbSubFrame * frame, guint32 * palette)
+{
+  const DvbSubPackedLayout *layout;
+  guint8 *bytes;
+  gint i, n_colors = 1 << rect->pict.palette_bits_count;
+
+  memset (palette, 0, 256 * sizeof (guint32));
+
+  switch (frame->format) {
+    case DVB_SUB_FRAME_FORMAT_I420:
+    case DVB_SUB_FRAME_FORMAT_NV12:
+      if (rect->pict.yuv_palette) {
+        memcpy (palette, rect->pict.yuv_palette, n_colors * sizeof (guint32));
+      } else {
+        for (i = 0; i < n_colors; i++)
+          palette[i] = dvb_color_argb_to_ayuv (rect->pict.palette[i],
+              frame->matrix);
+      }
+      break;
+    default:
+      /* In the byte order of the frame. 24-bit formats keep the alpha in
+       * the fourth byte */
+      layout = &packed_layouts[frame->format - DVB_SUB_FRAME_FORMAT_RGBA];
+      for (i = 0; i < n_colors; i++) {
+        bytes = (guint8 *) (palette + i);
+        bytes[layout->r] = (rect->pict.palette[i] >> 16) & 0xff;
+        bytes[layout->g] = (rect->pict.palette[i] >> 8) & 0xff;
+        bytes[layout->b] = rect->pict.palette[i] & 0xff;
+        bytes[layout->a < 0 ? 3 : layout->a] = rect->pict.palette[i] >> 24;
+      }
+      break;
+  }
+}
+
+static void
+_dvb_sub_blend_rgb24 (guint8 * dst, const guint32 * src, gint len)
+{
+  const guint8 *s;
+  guint a;
+  gint i, k;
+
+  for (i = 0; i < len; i++, dst += 3) {
+    s = (const guint8 *) (src + i);
+    a = s[3] + (s[3] >> 7);
+    if (!a)
+      continue;
+    for (k = 0; k < 3; k++)
+      dst[k] = (s[k] * a + dst[k] * (256 - a) + 128) >> 8;
+  }
+}
+
+/* Expands row y of rect between the frame columns x0 and x1 into out, which
+ * starts at column out_x. The rest of the len pixels of out are cleared to
+ * transparent */
+static void
+_dvb_sub_blend_expand_row (const DVBSubtitleRect * rect, gint y, gint x0,
+    gint x1, const guint32 * palette, guint32 * out, gint out_x, gint len)
+{
+  if (y < MAX (rect->y, 0) || y >= rect->y + rect->h) {
+    memset (out, 0, len * sizeof (guint32));
+    return;
+  }
+
+  memset (out, 0, (x0 - out_x) * sizeof (guint32));
+  dvb_pixels_expand_palette (rect->pict.data + (y - rect->y) *
+      rect->pict.rowstride + (x0 - rect->x), out + (x0 - out_x), x1 - x0,
+      palette, rect->pict.palette_bits_count);
+  memset (out + (x1 - out_x), 0, (len - (x1 - out_x)) * sizeof (guint32));
+}
+
+static void
+_dvb_sub_blend_rect_420 (const DVBSubtitleRect * rect,
+    const DvbSubFrame * frame, gint x0, gint y0, gint x1, gint y1,
+    const guint32 * palette, guint32 * top, guint32 * bottom)
+{
+  gboolean nv12 = frame->format == DVB_SUB_FRAME_FORMAT_NV12;
+  gint cx0 = x0 / 2, cx1 = (x1 + 1) / 2;
+  gint cy, len = 2 * (cx1 - cx0);
+  guint8 *u, *v;
+
+  /* Each chroma row covers two rows of the rect, the one above or below
+   * it being transparent if it's outside of the rect or frame */
+  for (cy = y0 / 2; cy < (y1 + 1) / 2; cy++) {
+    _dvb_sub_blend_expand_row (rect, 2 * cy, x0, x1, palette, top, 2 * cx0,
+        len);
+    if (2 * cy + 1 < y1)
+      _dvb_sub_blend_expand_row (rect, 2 * cy + 1, x0, x1, palette, bottom,
+          2 * cx0, len);
+    else
+      memset (bottom, 0, len * sizeof (guint32));
+
+    if (2 * cy >= y0)
+      dvb_pixels_blend_luma (frame->data[0] + 2 * cy * frame->stride[0] + x0,
+          top + (x0 - 2 * cx0), x1 - x0);
+    if (2 * cy + 1 < y1)
+      dvb_pixels_blend_luma (frame->data[0] + (2 * cy + 1) * frame->stride[0] +
+          x0, bottom + (x0 - 2 * cx0), x1 - x0);
+
+    if (nv12) {
+      u = frame->data[1] + cy * frame->stride[1] + 2 * cx0;
+      v = NULL;
+    } else {
+      u = frame->data[1] + cy * frame->stride[1] + cx0;
+      v = frame->data[2] + cy * frame->stride[2] + cx0;
+    }
+    dvb_pixels_blend_chroma_420 (u, v, top, bottom, cx1 - cx0);
+  }
+}
+
+static void
+_dvb_sub_blend_rect_packed (const DVBSubtitleRect * rect,
+    const DvbSubFrame * frame, gint x0, gint y0, gint x1, gint y1,
+    const guint32 * palette, guint32 * row)
+{
+  const DvbSubPackedLayout *layout;
+  guint8 *dst;
+  gint y;
+
+  layout = &packed_layouts[frame->format - DVB_SUB_FRAME_FORMAT_RGBA];
+
+  for (y = y0; y < y1; y++) {
+    dvb_pixels_expand_palette (rect->pict.data + (y - rect->y) *
+        rect->pict.rowstride + (x0 - rect->x), row, x1 - x0, palette,
+        rect->pict.palette_bits_count);
+
+    dst = frame->data[0] + y * frame->stride[0] + x0 * layout->bpp;
+    if (layout->bpp == 4)
+      dvb_pixels_blend_packed (dst, row, x1 - x0, layout->a);
+    else
+      _dvb_sub_blend_rgb24 (dst, row, x1 - x0);
+  }
+}
+
+/**
+ * dvb_subtitles_blend:
+ * @subs: the #DVBSubtitles to blend
+ * @frame: the frame to blend @subs onto
+ *
+ * Alpha blends all rects of @subs onto @frame in place, in the order they
+ * are in @subs. Rects reaching outside of @frame are clipped to it. For
+ * 4:2:0 frames each chroma sample gets the average of the 2x2 pixels it
+ * covers, weighted by their alpha. The alpha byte of 32-bit RGB frames is
+ * composited over, so opaque frames stay opaque.
+ *
+ * YUV frames are blended with the yuv_palette of the rects if the #DvbSub
+ * was set up to provide it with dvb_sub_set_yuv_palette(), which avoids
+ * converting colours and should use the colour matrix of @frame. Otherwise
+ * the ARGB palettes are converted with the matrix of @frame.
+ *
+ * This doesn't modify @subs, so the same subtitles can be blended onto
+ * several frames from different threads at once.
+ *
+ * Return value: %FALSE if @frame isn't valid
+ */
+gboolean
+dvb_subtitles_blend (DVBSubtitles * subs, const DvbSubFrame * frame)
+{
+  guint32 palette[256];
+  DVBSubtitleRect *rect;
+  guint32 *rows;
+  gint x0, y0, x1, y1, max_width = 0;
+  gboolean yuv;
+  guint i;
+
+  g_return_val_if_fail (subs != NULL, FALSE);
+  g_return_val_if_fail (frame != NULL, FALSE);
+  g_return_val_if_fail (frame->format <= DVB_SUB_FRAME_FORMAT_BGR, FALSE);
+  g_return_val_if_fail (frame->width >= 0 && frame->height >= 0, FALSE);
+  g_return_val_if_fail (frame->data[0] != NULL, FALSE);
+
+  yuv = frame->format == DVB_SUB_FRAME_FORMAT_I420
+      || frame->format == DVB_SUB_FRAME_FORMAT_NV12;
+  g_return_val_if_fail (!yuv || frame->data[1] != NULL, FALSE);
+  g_return_val_if_fail (frame->format != DVB_SUB_FRAME_FORMAT_I420
+      || frame->data[2] != NULL, FALSE);
+
+  for (i = 0; i < subs->num_rects; i++)
+    max_width = MAX (max_width, subs->rects[i]->w);
+  if (!max_width)
+    return TRUE;
+
+  /* Two rows of pixels, with room for a transparent one on each side */
+  rows = g_malloc (2 * (max_width + 2) * sizeof (guint32));
+
+  for (i = 0; i < subs->num_rects; i++) {
+    rect = subs->rects[i];
+
+    x0 = MAX (rect->x, 0);
+    y0 = MAX (rect->y, 0);
+    x1 = MIN (rect->x + rect->w, frame->width);
+    y1 = MIN (rect->y + rect->h, frame->height);
+    if (!rect->pict.data || x1 <= x0 || y1 <= y0)
+      continue;
+
+    _dvb_sub_blend_prepare_palette (rect, frame, palette);
+
+    if (yuv)
+      _dvb_sub_blend_rect_420 (rect, frame, x0, y0, x1, y1, palette, rows,
+          rows + max_width + 2);
+    else
+      _dvb_sub_blend_rect_packed (rect, frame, x0, y0, x1, y1, palette, rows);
+  }
+
+  g_free (rows);
+
+  return TRUE;
+}
@@ -0,0 +1,82 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DVB_SUB_BLEND_H_
+#define _DVB_SUB_BLEND_H_
+
+#include <glib.h>
+#include "dvb-sub.h"
+
+G_BEGIN_DECLS
+
+/**
+ * DvbSubFrameFormat:
+ * @DVB_SUB_FRAME_FORMAT_I420: planar 4:2:0 YUV, with a Y, a U and a V plane
+ * @DVB_SUB_FRAME_FORMAT_NV12: 4:2:0 YUV with a Y plane and an interleaved UV plane
+ * @DVB_SUB_FRAME_FORMAT_RGBA: packed RGB, bytes in the order red, green, blue, alpha
+ * @DVB_SUB_FRAME_FORMAT_BGRA: packed RGB, bytes in the order blue, green, red, alpha
+ * @DVB_SUB_FRAME_FORMAT_ARGB: packed RGB, bytes in the order alpha, red, green, blue
+ * @DVB_SUB_FRAME_FORMAT_ABGR: packed RGB, bytes in the order alpha, blue, green, red
+ * @DVB_SUB_FRAME_FORMAT_RGB: packed RGB, 3 bytes in the order red, green, blue
+ * @DVB_SUB_FRAME_FORMAT_BGR: packed RGB, 3 bytes in the order blue, green, red
+ *
+ * The frame formats dvb_subtitles_blend() can blend onto, named by byte
+ * order in memory like GStreamer video formats. The alpha byte of the
+ * formats with one may as well be padding, as with RGBx and the like.
+ */
+typedef enum {
+	DVB_SUB_FRAME_FORMAT_I420,
+	DVB_SUB_FRAME_FORMAT_NV12,
+	DVB_SUB_FRAME_FORMAT_RGBA,
+	DVB_SUB_FRAME_FORMAT_BGRA,
+	DVB_SUB_FRAME_FORMAT_ARGB,
+	DVB_SUB_FRAME_FORMAT_ABGR,
+	DVB_SUB_FRAME_FORMAT_RGB,
+	DVB_SUB_FRAME_FORMAT_BGR
+} DvbSubFrameFormat;
+
+/**
+ * DvbSubFrame:
+ * @format: the #DvbSubFrameFormat of the frame
+ * @width: the width of the frame in pixels
+ * @height: the height of the frame in pixels
+ * @data: the planes of the frame; only the first is used for packed formats
+ * @stride: the number of bytes between the starts of two rows of each plane
+ * @matrix: the colour matrix of YUV frames, used when the subtitles have no
+ *   yuv_palette in their #DVBSubtitlePicture
+ *
+ * A video frame provided by the caller to blend subtitles onto.
+ */
+typedef struct {
+	DvbSubFrameFormat format;
+	gint width;
+	gint height;
+	guint8 *data[3];
+	gint stride[3];
+	DVBSubtitleColorMatrix matrix;
+	/*< private >*/
+	gpointer _dvb_sub_reserved[2];
+} DvbSubFrame;
+
+gboolean dvb_subtitles_blend (DVBSubtitles *subs, const DvbSubFrame *frame);
+
+G_END_DECLS
+
+#endif /* _DVB_SUB_BLEND_H_ */
@@ -0,0 +1,559 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "dvb-sub-mux.h"
+#include <string.h>             /* memcmp */
+#include "dvb-demux.h"
+#include "dvb-log.h"
+
+/**
+ * SECTION:dvb-sub-mux
+ * @short_description: subtitle decoding of a whole MPEG transport stream multiplex
+ * @stability: Unstable
+ *
+ * The #DvbSubMux decodes all the DVB subtitle streams of a transport stream
+ * multiplex in a single pass over the data. It follows the PAT and the PMTs
+ * of the programs in it, and creates a #DvbSub for every elementary stream
+ * that carries a subtitling_descriptor, announcing it through the
+ * new_stream callback. Each transport stream packet is looked at once and
+ * routed by its PID, so the multiplex is read only once regardless of the
+ * number of subtitle services in it.
+ */
+
+#define DVB_TS_PID_COUNT 0x2000
+#define DVB_TS_PID_PAT 0x0000
+
+#define DVB_TABLE_ID_PAT 0x00
+#define DVB_TABLE_ID_PMT 0x02
+
+#define DVB_STREAM_TYPE_PES_PRIVATE 0x06
+#define DVB_DESCRIPTOR_TAG_SUBTITLING 0x59
+
+typedef struct _DvbSubMuxStream
+{
+  DvbSubMux *mux;
+  guint16 program_number;
+  guint16 pid;
+
+  DvbSub *dvb_sub;
+  DvbPesAssembler pes;
+
+  DvbSubMuxService *services;
+  guint n_services;
+} DvbSubMuxStream;
+
+typedef struct _DvbSubMuxProgram
+{
+  guint16 program_number;
+  guint16 pmt_pid;
+  gint version;                 /* -1 until the first PMT */
+} DvbSubMuxProgram;
+
+/* A PID carrying PSI sections; several programs may share a PMT PID */
+typedef struct _DvbSubMuxSectionPid
+{
+  DvbSectionAssembler assembler;
+  guint n_users;
+} DvbSubMuxSectionPid;
+
+typedef struct _DvbSubMuxPrivate DvbSubMuxPrivate;
+struct _DvbSubMuxPrivate
+{
+  DvbSubMuxCallbacks callbacks;
+  gpointer user_data;
+
+  gint pat_version;             /* -1 until the first PAT */
+  GSList *programs;
+
+  /* Routing tables directly indexed by PID */
+  DvbSubMuxSectionPid *section_pids[DVB_TS_PID_COUNT];
+  DvbSubMuxStream *stream_pids[DVB_TS_PID_COUNT];
+};
+
+#define DVB_SUB_MUX_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), DVB_TYPE_SUB_MUX, DvbSubMuxPrivate))
+
+G_DEFINE_TYPE (DvbSubMux, dvb_sub_mux, G_TYPE_OBJECT);
+
+static void _dvb_sub_mux_parse_pat (const guint8 * section, gint len,
+    gpointer user_data);
+static void _dvb_sub_mux_parse_pmt (const guint8 * section, gint len,
+    gpointer user_data);
+
+static void
+add_section_pid (DvbSubMux * mux, guint16 pid, DvbSectionFunc func)
+{
+  DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) mux->private_data;
+  DvbSubMuxSectionPid *section_pid = priv->section_pids[pid];
+
+  if (!section_pid) {
+    section_pid = g_slice_new (DvbSubMuxSectionPid);
+    dvb_section_assembler_init (&section_pid->assembler, pid, func, mux);
+    section_pid->n_users = 0;
+    priv->section_pids[pid] = section_pid;
+  }
+
+  section_pid->n_users++;
+}
+
+static void
+remove_section_pid (DvbSubMux * mux, guint16 pid)
+{
+  DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) mux->private_data;
+  DvbSubMuxSectionPid *section_pid = priv->section_pids[pid];
+
+  g_return_if_fail (section_pid != NULL);
+
+  if (--section_pid->n_users == 0) {
+    g_slice_free (DvbSubMuxSectionPid, section_pid);
+    priv->section_pids[pid] = NULL;
+  }
+}
+
+static void
+_dvb_sub_mux_pes_func (guint64 pts, guint8 * data, gint len, gpointer user_data)
+{
+  DvbSubMuxStream *stream = user_data;
+
+  dvb_sub_feed_with_pts (stream->dvb_sub, pts, data, len);
+}
+
+static void
+add_stream (DvbSubMux * mux, guint16 program_number, guint16 pid,
+    DvbSubMuxService * services, guint n_services)
+{
+  DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) mux->private_data;
+  DvbSubMuxStream *stream = g_slice_new0 (DvbSubMuxStream);
+
+  stream->mux = mux;
+  stream->program_number = program_number;
+  stream->pid = pid;
+  stream->dvb_sub = dvb_sub_new ();
+  /* With several services the API user picks one in new_stream */
+  if (n_services == 1)
+    dvb_sub_set_page_ids (stream->dvb_sub, services[0].composition_page_id,
+        services[0].ancillary_page_id);
+  dvb_pes_assembler_init (&stream->pes, pid, _dvb_sub_mux_pes_func, stream);
+  stream->services = services;
+  stream->n_services = n_services;
+
+  priv->stream_pids[pid] = stream;
+
+  dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_INFO,
+      "New subtitle stream on PID %u of program %u with %u services",
+      pid, program_number, n_services);
+
+  if (priv->callbacks.new_stream)
+    priv->callbacks.new_stream (mux, stream->dvb_sub, program_number, pid,
+        services, n_services, priv->user_data);
+}
+
+static void
+remove_stream (DvbSubMux * mux, DvbSubMuxStream * stream, gboolean notify)
+{
+  DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) mux->private_data;
+
+  priv->stream_pids[stream->pid] = NULL;
+
+  if (notify && priv->callbacks.stream_removed)
+    priv->callbacks.stream_removed (mux, stream->dvb_sub,
+        stream->program_number, stream->pid, priv->user_data);
+
+  g_object_unref (stream->dvb_sub);
+  dvb_pes_assembler_clear (&stream->pes);
+  g_free (stream->services);
+  g_slice_free (DvbSubMuxStream, stream);
+}
+
+static void
+remove_program (DvbSubMux * mux, DvbSubMuxProgram * program, gboolean notify)
+{
+  DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) mux->private_data;
+  guint pid;
+
+  for (pid = 0; pid < DVB_TS_PID_COUNT; ++pid) {
+    DvbSubMuxStream *stream = priv->stream_pids[pid];
+    if (stream && stream->program_number == program->program_number)
+      remove_stream (mux, stream, notify);
+  }
+
+  remove_section_pid (mux, program->pmt_pid);
+  priv->programs = g_slist_remove (priv->programs, program);
+  g_slice_free (DvbSubMuxProgram, program);
+}
+
+/* Drops whatever all PIDs were reassembling, e.g after a loss of sync */
+static void
+reset_assemblers (DvbSubMux * mux)
+{
+  DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) mux->private_data;
+  guint pid;
+
+  for (pid = 0; pid < DVB_TS_PID_COUNT; ++pid) {
+    if (priv->stream_pids[pid])
+      dvb_pes_assembler_reset (&priv->stream_pids[pid]->pes);
+    if (priv->section_pids[pid])
+      dvb_section_assembler_reset (&priv->section_pids[pid]->assembler);
+  }
+}
+
+static DvbSubMuxProgram *
+get_program (DvbSubMux * mux, guint16 program_number)
+{
+  const DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) mux->private_data;
+  GSList *l;
+
+  for (l = priv->programs; l; l = l->next) {
+    DvbSubMuxProgram *program = l->data;
+    if (program->program_number == program_number)
+      return program;
+  }
+
+  return NULL;
+}
+
+/* Compares service lists field by field, DvbSubMuxService has padding */
+static gboolean
+services_equal (const DvbSubMuxService * a, const DvbSubMuxService * b,
+    guint n_services)
+{
+  guint i;
+
+  for (i = 0; i < n_services; ++i) {
+    if (memcmp (a[i].language, b[i].language, sizeof (a[i].language)) != 0 ||
+        a[i].subtitling_type != b[i].subtitling_type ||
+        a[i].composition_page_id != b[i].composition_page_id ||
+        a[i].ancillary_page_id != b[i].ancillary_page_id)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+dvb_sub_mux_init (DvbSubMux * self)
+{
+  DvbSubMuxPrivate *priv;
+
+  self->private_data = priv = DVB_SUB_MUX_GET_PRIVATE (self);
+
+  priv->pat_version = -1;
+  priv->programs = NULL;
+  memset (priv->section_pids, 0, sizeof (priv->section_pids));
+  memset (priv->stream_pids, 0, sizeof (priv->stream_pids));
+
+  add_section_pid (self, DVB_TS_PID_PAT, _dvb_sub_mux_parse_pat);
+}
+
+static void
+dvb_sub_mux_finalize (GObject * object)
+{
+  DvbSubMux *self = DVB_SUB_MUX (object);
+  DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) self->private_data;
+
+  while (priv->programs)
+    remove_program (self, priv->programs->data, FALSE);
+  remove_section_pid (self, DVB_TS_PID_PAT);
+
+  G_OBJECT_CLASS (dvb_sub_mux_parent_class)->finalize (object);
+}
+
+static void
+dvb_sub_mux_class_init (DvbSubMuxClass * klass)
+{
+  GObjectClass *object_class = (GObjectClass *) klass;
+
+  object_class->finalize = dvb_sub_mux_finalize;
+
+  g_type_class_add_private (klass, sizeof (DvbSubMuxPrivate));
+}
+
+static void
+_dvb_sub_mux_parse_pat (const guint8 * section, gint len, gpointer user_data)
+{
+  DvbSubMux *mux = user_data;
+  DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) mux->private_data;
+  DvbSubMuxProgram *program;
+  const guint8 *buf, *buf_end;
+  guint16 program_number, pmt_pid;
+  gint version;
+  gboolean complete;
+  GSList *l, *seen = NULL;
+
+  if (section[0] != DVB_TABLE_ID_PAT || len < 12)
+    return;
+
+  if (!(section[5] & 1))        /* current_next_indicator - not applicable yet */
+    return;
+
+  version = (section[5] >> 1) & 0x1f;
+  /* Only a single section PAT is known to list all of the programs */
+  complete = section[6] == 0 && section[7] == 0;
+
+  if (complete && version == priv->pat_version)
+    return;
+
+  dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_DEBUG,
+      "PAT version %d, transport_stream_id %u", version,
+      (section[3] << 8) | section[4]);
+
+  buf = section + 8;
+  buf_end = section + len - 4;  /* CRC_32 */
+
+  for (; buf + 4 <= buf_end; buf += 4) {
+    program_number = (buf[0] << 8) | buf[1];
+    pmt_pid = ((buf[2] & 0x1f) << 8) | buf[3];
+
+    if (program_number == 0)    /* network_PID */
+      continue;
+
+    program = get_program (mux, program_number);
+    if (program && program->pmt_pid != pmt_pid) {
+      remove_program (mux, program, TRUE);
+      program = NULL;
+    }
+
+    if (!program) {
+      program = g_slice_new (DvbSubMuxProgram);
+      program->program_number = program_number;
+      program->pmt_pid = pmt_pid;
+      program->version = -1;
+      priv->programs = g_slist_prepend (priv->programs, program);
+      add_section_pid (mux, pmt_pid, _dvb_sub_mux_parse_pmt);
+    }
+
+    seen = g_slist_prepend (seen, program);
+  }
+
+  if (complete) {
+    priv->pat_version = version;
+
+    l = priv->programs;
+    while (l) {
+      program = l->data;
+      l = l->next;
+      if (!g_slist_find (seen, program))
+        remove_program (mux, program, TRUE);
+    }
+  }
+
+  g_slist_free (seen);
+}
+
+static void
+_dvb_sub_mux_parse_pmt (const guint8 * section, gint len, gpointer user_data)
+{
+  DvbSubMux *mux = user_data;
+  DvbSubMuxPrivate *priv = (DvbSubMuxPrivate *) mux->private_data;
+  DvbSubMuxProgram *program;
+  DvbSubMuxStream *stream;
+  DvbSubMuxService *services;
+  const guint8 *buf, *buf_end, *desc, *desc_end;
+  guint16 program_number, pid;
+  guint8 stream_type;
+  guint n_services, es_info_len, pid_index;
+  gint version;
+  guint8 listed[DVB_TS_PID_COUNT / 8] = { 0, };
+
+  if (section[0] != DVB_TABLE_ID_PMT || len < 16)
+    return;
+
+  if (!(section[5] & 1))        /* current_next_indicator - not applicable yet */
+    return;
+
+  program_number = (section[3] << 8) | section[4];
+  version = (section[5] >> 1) & 0x1f;
+
+  program = get_program (mux, program_number);
+  if (!program || program->version == version)
+    return;
+
+  program->version = version;
+
+  dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_DEBUG,
+      "PMT version %d for program %u", version, program_number);
+
+  buf = section + 12 + (((section[10] & 0x0f) << 8) | section[11]);
+  buf_end = section + len - 4;  /* CRC_32 */
+
+  while (buf + 5 <= buf_end) {
+    stream_type = buf[0];
+    pid = ((buf[1] & 0x1f) << 8) | buf[2];
+    es_info_len = ((buf[3] & 0x0f) << 8) | buf[4];
+    buf += 5;
+
+    desc = buf;
+    desc_end = MIN (buf + es_info_len, buf_end);
+    buf += es_info_len;
+
+    if (stream_type != DVB_STREAM_TYPE_PES_PRIVATE)
+      continue;
+
+    services = NULL;
+    n_services = 0;
+
+    while (desc + 2 <= desc_end && desc + 2 + desc[1] <= desc_end) {
+      if (desc[0] == DVB_DESCRIPTOR_TAG_SUBTITLING) {
+        const guint8 *entry = desc + 2;
+        const guint8 *entry_end = desc + 2 + desc[1];
+
+        for (; entry + 8 <= entry_end; entry += 8) {
+          DvbSubMuxService *service;
+
+          services = g_renew (DvbSubMuxService, services, n_services + 1);
+          service = &services[n_services++];
+
+          memcpy (service->language, entry, 3);
+          service->language[3] = '\0';
+          service->subtitling_type = entry[3];
+          service->composition_page_id = (entry[4] << 8) | entry[5];
+          service->ancillary_page_id = (entry[6] << 8) | entry[7];
+        }
+      }
+      desc += 2 + desc[1];
+    }
+
+    if (!n_services)
+      continue;
+
+    stream = priv->stream_pids[pid];
+
+    if (stream && stream->program_number != program_number) {
+      /* The PID is already decoded as part of another program */
+      g_free (services);
+      continue;
+    }
+
+    listed[pid / 8] |= 1 << (pid % 8);
+
+    if (stream && stream->n_services == n_services &&
+        services_equal (stream->services, services, n_services)) {
+      g_free (services);
+      continue;                 /* unchanged */
+    }
+
+    if (stream)
+      remove_stream (mux, stream, TRUE);
+    add_stream (mux, program_number, pid, services, n_services);
+  }
+
+  /* Drop the streams no longer listed for this program */
+  for (pid_index = 0; pid_index < DVB_TS_PID_COUNT; ++pid_index) {
+    stream = priv->stream_pids[pid_index];
+    if (stream && stream->program_number == program_number &&
+        !(listed[pid_index / 8] & (1 << (pid_index % 8))))
+      remove_stream (mux, stream, TRUE);
+  }
+}
+
+/**
+ * dvb_sub_mux_new:
+ *
+ * Creates a new #DvbSubMux.
+ *
+ * Return value: a newly created #DvbSubMux
+ */
+DvbSubMux *
+dvb_sub_mux_new (void)
+{
+  DvbSubMux *mux = g_object_new (DVB_TYPE_SUB_MUX, NULL);
+
+  return mux;
+}
+
+/**
+ * dvb_sub_mux_feed:
+ * @mux: a #DvbSubMux
+ * @data: MPEG transport stream data of the whole multiplex
+ * @len: Length of the data
+ *
+ * Feeds transport stream data to the multiplex. PAT and PMT sections are
+ * parsed as they come, and the packets of the known subtitle streams are
+ * reassembled and decoded by their #DvbSub instances. All other packets are
+ * skipped by their PID alone.
+ *
+ * Only whole transport stream packets are consumed, so data left over after
+ * the last complete packet should be fed again together with the following
+ * data.
+ *
+ * Return value: Amount of data consumed
+ */
+gint
+dvb_sub_mux_feed (DvbSubMux * mux, guint8 * data, gint len)
+{
+  DvbSubMuxPrivate *priv;
+  DvbSubMuxStream *stream;
+  DvbSubMuxSectionPid *section_pid;
+  DvbTsPacket packet;
+  guint8 *ts_packet;
+  gboolean resynced;
+  guint16 pid;
+  gint pos = 0;
+
+  g_return_val_if_fail (mux != NULL, -1);
+  g_return_val_if_fail (DVB_IS_SUB_MUX (mux), -1);
+  g_return_val_if_fail (data != NULL || len == 0, -1);
+
+  priv = (DvbSubMuxPrivate *) mux->private_data;
+
+  for (;;) {
+    ts_packet = dvb_ts_next_packet (data, len, &pos, &resynced);
+    if (resynced)
+      reset_assemblers (mux);
+    if (!ts_packet)
+      break;
+
+    pid = ((ts_packet[1] & 0x1f) << 8) | ts_packet[2];
+
+    if ((stream = priv->stream_pids[pid])) {
+      if (dvb_ts_packet_parse (ts_packet, &packet))
+        dvb_pes_assembler_push (&stream->pes, &packet);
+    } else if ((section_pid = priv->section_pids[pid])) {
+      if (dvb_ts_packet_parse (ts_packet, &packet))
+        dvb_section_assembler_push (&section_pid->assembler, &packet);
+    }
+  }
+
+  return pos;
+}
+
+/**
+ * dvb_sub_mux_set_callbacks:
+ * @mux: a #DvbSubMux
+ * @callbacks: the callbacks to install
+ * @user_data: a user_data argument for the callbacks
+ *
+ * Set callbacks which will be executed when subtitle streams appear in or
+ * disappear from the multiplex.
+ */
+void
+dvb_sub_mux_set_callbacks (DvbSubMux * mux, DvbSubMuxCallbacks * callbacks,
+    gpointer user_data)
+{
+  DvbSubMuxPrivate *priv;
+
+  g_return_if_fail (mux != NULL);
+  g_return_if_fail (DVB_IS_SUB_MUX (mux));
+  g_return_if_fail (callbacks != NULL);
+
+  priv = (DvbSubMuxPrivate *) mux->private_data;
+
+  priv->callbacks = *callbacks;
+  priv->user_data = user_data;
+}
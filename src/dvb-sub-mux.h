@@ -0,0 +1,109 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DVB_SUB_MUX_H_
+#define _DVB_SUB_MUX_H_
+
+#include <glib-object.h>
+#include "dvb-sub.h"
+
+G_BEGIN_DECLS
+
+#define DVB_TYPE_SUB_MUX             (dvb_sub_mux_get_type ())
+#define DVB_SUB_MUX(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj), DVB_TYPE_SUB_MUX, DvbSubMux))
+#define DVB_SUB_MUX_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST ((klass), DVB_TYPE_SUB_MUX, DvbSubMuxClass))
+#define DVB_IS_SUB_MUX(obj)          (G_TYPE_CHECK_INSTANCE_TYPE ((obj), DVB_TYPE_SUB_MUX))
+#define DVB_IS_SUB_MUX_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE ((klass), DVB_TYPE_SUB_MUX))
+#define DVB_SUB_MUX_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS ((obj), DVB_TYPE_SUB_MUX, DvbSubMuxClass))
+
+typedef struct _DvbSubMuxClass DvbSubMuxClass;
+typedef struct _DvbSubMux DvbSubMux;
+
+struct _DvbSubMuxClass
+{
+	GObjectClass parent_class;
+};
+
+/**
+ * DvbSubMux:
+ *
+ * The #DvbSubMux struct contains only private fields and should not be
+ * directly accessed.
+ */
+struct _DvbSubMux
+{
+	GObject parent_instance;
+
+	/*< private >*/
+	gpointer private_data;
+};
+
+/**
+ * DvbSubMuxService:
+ * @language: the ISO 639-2 language code of the service, NUL terminated
+ * @subtitling_type: the subtitling_type, e.g 0x10 for normal DVB subtitles
+ *   or 0x20 for subtitles for the hard of hearing
+ * @composition_page_id: the page carrying the subtitles of this service
+ * @ancillary_page_id: the page carrying data shared between services
+ *
+ * One subtitling service of a subtitle stream, as signalled by an entry of the
+ * subtitling_descriptor in the PMT.
+ */
+typedef struct DvbSubMuxService {
+	gchar language[4];
+	guint8 subtitling_type;
+	guint16 composition_page_id;
+	guint16 ancillary_page_id;
+} DvbSubMuxService;
+
+/**
+ * DvbSubMuxCallbacks:
+ * @new_stream: called when a new subtitle stream is found in a PMT. @dvb_sub
+ *    is the #DvbSub instance that will decode the stream with PID @pid of
+ *    program @program_number, which carries the @n_services subtitling
+ *    @services. This is the place to install the callbacks of @dvb_sub with
+ *    dvb_sub_set_callbacks() and, if there are several services, to select
+ *    the one to decode with dvb_sub_set_page_ids() - a single service is
+ *    selected already; @user_data is the same user_data as was passed
+ *    through dvb_sub_mux_set_callbacks();
+ * @stream_removed: called when a subtitle stream previously announced with
+ *    @new_stream disappears from its PMT, right before its @dvb_sub is
+ *    released by the multiplex.
+ *
+ * A set of callbacks that can be installed on the #DvbSubMux with
+ * dvb_sub_mux_set_callbacks().
+ */
+typedef struct {
+	void     (*new_stream)     (DvbSubMux *mux, DvbSub *dvb_sub, guint16 program_number, guint16 pid,
+	                            const DvbSubMuxService *services, guint n_services, gpointer user_data);
+	void     (*stream_removed) (DvbSubMux *mux, DvbSub *dvb_sub, guint16 program_number, guint16 pid,
+	                            gpointer user_data);
+	/*< private >*/
+	gpointer _dvb_sub_mux_reserved[2];
+} DvbSubMuxCallbacks;
+
+GType      dvb_sub_mux_get_type      (void) G_GNUC_CONST;
+DvbSubMux *dvb_sub_mux_new           (void);
+gint       dvb_sub_mux_feed          (DvbSubMux *mux, guint8 *data, gint len);
+void       dvb_sub_mux_set_callbacks (DvbSubMux *mux, DvbSubMuxCallbacks *callbacks, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* _DVB_SUB_MUX_H_ */
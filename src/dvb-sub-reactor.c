@@ -0,0 +1,895 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "dvb-sub-reactor.h"
+#include <unistd.h>             /* close */
+#include <stdio.h>              /* perror */
+#include <string.h>             /* strerror */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include "dvb-log.h"
+
+/**
+ * SECTION:dvb-sub-reactor
+ * @short_description: reading many demux file descriptors from one event source
+ * @stability: Unstable
+ *
+ * The #DvbSubReactor multiplexes the demux file descriptors of many #DvbSub
+ * instances, opened with dvb_sub_open_pid() on any number of adapters, into a
+ * single file descriptor. Instead of installing a file watch per PID, the API
+ * user watches only dvb_sub_reactor_get_fd() for reading, e.g with
+ * g_io_add_watch(), and calls dvb_sub_reactor_dispatch() in its callback. All
+ * the demux file descriptors that are ready are then drained in one go.
+ *
+ * By default the reactor is backed by epoll, and each ready #DvbSub reads its
+ * data with dvb_sub_read_data(). If libdvbsub was built with liburing, a
+ * reactor created with %DVB_SUB_REACTOR_BACKEND_IO_URING instead keeps a
+ * multishot read queued on every demux file descriptor, so the kernel fills
+ * buffers shared with the reactor as data arrives, and a dispatch only has to
+ * feed the completed buffers to the parsers with dvb_sub_feed_stream(). Such
+ * a reactor can also read recorded PES files asynchronously with large reads,
+ * see dvb_sub_reactor_add_file().
+ */
+
+/* Maximum events fetched per epoll_wait() call; more ready descriptors are
+ * fetched with further calls within the same dispatch */
+#define DVB_SUB_REACTOR_MAX_EVENTS 64
+
+#ifdef HAVE_LIBURING
+/* Submission queue size; completion queue is twice that by default */
+#define DVB_SUB_REACTOR_URING_ENTRIES 256
+/* Buffers provided to the multishot demux reads, shared by all demux sources */
+#define DVB_SUB_REACTOR_DEMUX_BUFFERS 64
+#define DVB_SUB_REACTOR_DEMUX_BUFFER_SIZE (16 * 1024)
+#define DVB_SUB_REACTOR_DEMUX_BUFFER_GROUP 0
+/* Registered buffers for file reads, shared by all file sources */
+#define DVB_SUB_REACTOR_FILE_BUFFERS 16
+#define DVB_SUB_REACTOR_FILE_BUFFER_SIZE (1024 * 1024)
+/* Maximum reads in flight per file, so that several files make progress */
+#define DVB_SUB_REACTOR_FILE_QUEUE_DEPTH 4
+#endif
+
+typedef enum
+{
+  DVB_SUB_REACTOR_SOURCE_DEMUX,
+  DVB_SUB_REACTOR_SOURCE_FILE,
+  DVB_SUB_REACTOR_SOURCE_FILE_READ
+} DvbSubReactorSourceType;
+
+/* A demux file descriptor or a file being read. The type is the first member
+ * so that io_uring user data can point to either this or a read in flight */
+typedef struct _DvbSubReactorSource DvbSubReactorSource;
+struct _DvbSubReactorSource
+{
+  DvbSubReactorSourceType type;
+  DvbSub *dvb_sub;              /* NULL once removed */
+  int fd;
+
+#ifdef HAVE_LIBURING
+  /* Demux sources: multishot read queued */
+  gboolean armed;
+
+  /* File sources */
+  guint64 offset;               /* of the next read to queue */
+  guint next_seq;               /* sequence number of the next read to queue */
+  guint feed_seq;               /* sequence number of the next read to feed */
+  guint in_flight;
+  gboolean eof;
+  gboolean failed;
+  gboolean gap;                 /* a failed read was reached in file order */
+  GSList *completed;            /* reads completed out of order, by seq */
+  DvbSubReactorFileFunc done_func;
+  gpointer done_data;
+#endif
+};
+
+#ifdef HAVE_LIBURING
+typedef struct _DvbSubReactorRead DvbSubReactorRead;
+struct _DvbSubReactorRead
+{
+  DvbSubReactorSourceType type; /* always DVB_SUB_REACTOR_SOURCE_FILE_READ */
+  DvbSubReactorSource *source;
+  guint seq;
+  gint buffer;                  /* index into the registered buffers */
+  gint len;                     /* -1 if the read failed */
+};
+#endif
+
+typedef struct _DvbSubReactorPrivate DvbSubReactorPrivate;
+struct _DvbSubReactorPrivate
+{
+  DvbSubReactorBackend backend;
+  int epoll_fd;
+  GHashTable *subs;             /* DvbSub -> DvbSubReactorSource */
+  guint n_sources;              /* including removed ones still in flight */
+
+#ifdef HAVE_LIBURING
+  struct io_uring ring;
+  struct io_uring_buf_ring *demux_ring;
+  guint8 *demux_buffers;
+  guint8 *file_buffers;         /* registered on first use */
+  guint32 free_file_buffers;    /* bitmask of unused file buffers */
+  GSList *files;                /* file sources waiting for buffers */
+#endif
+};
+
+#define DVB_SUB_REACTOR_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), DVB_TYPE_SUB_REACTOR, DvbSubReactorPrivate))
+
+G_DEFINE_TYPE (DvbSubReactor, dvb_sub_reactor, G_TYPE_OBJECT);
+
+static void
+dvb_sub_reactor_init (DvbSubReactor * self)
+{
+  DvbSubReactorPrivate *priv;
+
+  self->private_data = priv = DVB_SUB_REACTOR_GET_PRIVATE (self);
+
+  priv->backend = DVB_SUB_REACTOR_BACKEND_EPOLL;
+  priv->epoll_fd = -1;
+  priv->subs = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      g_object_unref, NULL);
+}
+
+static void
+_dvb_sub_reactor_source_free (DvbSubReactorPrivate * priv,
+    DvbSubReactorSource * source)
+{
+  if (source->type == DVB_SUB_REACTOR_SOURCE_FILE && source->fd >= 0)
+    close (source->fd);
+  g_slice_free (DvbSubReactorSource, source);
+  priv->n_sources--;
+}
+
+static void _dvb_sub_reactor_source_remove (DvbSubReactorPrivate * priv,
+    DvbSubReactorSource * source);
+#ifdef HAVE_LIBURING
+static gint _dvb_sub_reactor_dispatch_uring (DvbSubReactor * reactor,
+    gint timeout);
+#endif
+
+static gboolean
+_dvb_sub_reactor_remove_source (gpointer dvb_sub, gpointer source,
+    gpointer priv)
+{
+  _dvb_sub_reactor_source_remove (priv, source);
+  return TRUE;
+}
+
+static void
+dvb_sub_reactor_finalize (GObject * object)
+{
+  DvbSubReactor *self = DVB_SUB_REACTOR (object);
+  DvbSubReactorPrivate *priv = (DvbSubReactorPrivate *) self->private_data;
+
+  g_hash_table_foreach_remove (priv->subs, _dvb_sub_reactor_remove_source,
+      priv);
+  g_hash_table_destroy (priv->subs);
+
+  if (priv->epoll_fd >= 0)
+    close (priv->epoll_fd);
+
+#ifdef HAVE_LIBURING
+  if (priv->backend == DVB_SUB_REACTOR_BACKEND_IO_URING) {
+    /* The kernel may still write into our buffers until the cancelled and
+     * remaining reads complete, so wait for them before tearing down */
+    while (priv->n_sources > 0)
+      if (_dvb_sub_reactor_dispatch_uring (self, -1) < 0)
+        break;
+
+    io_uring_free_buf_ring (&priv->ring, priv->demux_ring,
+        DVB_SUB_REACTOR_DEMUX_BUFFERS, DVB_SUB_REACTOR_DEMUX_BUFFER_GROUP);
+    io_uring_queue_exit (&priv->ring);
+    g_free (priv->demux_buffers);
+    g_free (priv->file_buffers);
+    g_slist_free (priv->files);
+  }
+#endif
+
+  G_OBJECT_CLASS (dvb_sub_reactor_parent_class)->finalize (object);
+}
+
+static void
+dvb_sub_reactor_class_init (DvbSubReactorClass * klass)
+{
+  GObjectClass *object_class = (GObjectClass *) klass;
+
+  object_class->finalize = dvb_sub_reactor_finalize;
+
+  g_type_class_add_private (klass, sizeof (DvbSubReactorPrivate));
+}
+
+static gboolean
+_dvb_sub_reactor_init_epoll (DvbSubReactorPrivate * priv)
+{
+  priv->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (priv->epoll_fd < 0) {
+    perror ("epoll_create1");
+    return FALSE;
+  }
+
+  priv->backend = DVB_SUB_REACTOR_BACKEND_EPOLL;
+  return TRUE;
+}
+
+#ifdef HAVE_LIBURING
+static gboolean
+_dvb_sub_reactor_init_uring (DvbSubReactorPrivate * priv)
+{
+  gint ret, i, mask;
+
+  ret = io_uring_queue_init (DVB_SUB_REACTOR_URING_ENTRIES, &priv->ring, 0);
+  if (ret < 0) {
+    g_warning ("Failed to set up io_uring: %s", strerror (-ret));
+    return FALSE;
+  }
+
+  priv->demux_ring = io_uring_setup_buf_ring (&priv->ring,
+      DVB_SUB_REACTOR_DEMUX_BUFFERS, DVB_SUB_REACTOR_DEMUX_BUFFER_GROUP, 0,
+      &ret);
+  if (!priv->demux_ring) {
+    g_warning ("Failed to set up io_uring buffer ring: %s", strerror (-ret));
+    io_uring_queue_exit (&priv->ring);
+    return FALSE;
+  }
+
+  priv->demux_buffers = g_malloc (DVB_SUB_REACTOR_DEMUX_BUFFERS *
+      DVB_SUB_REACTOR_DEMUX_BUFFER_SIZE);
+  mask = io_uring_buf_ring_mask (DVB_SUB_REACTOR_DEMUX_BUFFERS);
+  for (i = 0; i < DVB_SUB_REACTOR_DEMUX_BUFFERS; ++i)
+    io_uring_buf_ring_add (priv->demux_ring,
+        priv->demux_buffers + i * DVB_SUB_REACTOR_DEMUX_BUFFER_SIZE,
+        DVB_SUB_REACTOR_DEMUX_BUFFER_SIZE, i, mask, i);
+  io_uring_buf_ring_advance (priv->demux_ring, DVB_SUB_REACTOR_DEMUX_BUFFERS);
+
+  priv->backend = DVB_SUB_REACTOR_BACKEND_IO_URING;
+  return TRUE;
+}
+
+static struct io_uring_sqe *
+_dvb_sub_reactor_get_sqe (DvbSubReactorPrivate * priv)
+{
+  struct io_uring_sqe *sqe;
+
+  /* If the submission queue is full, flush it to the kernel first */
+  while (!(sqe = io_uring_get_sqe (&priv->ring)))
+    io_uring_submit (&priv->ring);
+
+  return sqe;
+}
+
+static void
+_dvb_sub_reactor_arm_demux (DvbSubReactorPrivate * priv,
+    DvbSubReactorSource * source)
+{
+  struct io_uring_sqe *sqe = _dvb_sub_reactor_get_sqe (priv);
+
+  io_uring_prep_read_multishot (sqe, source->fd, 0, 0,
+      DVB_SUB_REACTOR_DEMUX_BUFFER_GROUP);
+  io_uring_sqe_set_data (sqe, source);
+  source->armed = TRUE;
+}
+
+static void
+_dvb_sub_reactor_cancel (DvbSubReactorPrivate * priv, gpointer user_data)
+{
+  struct io_uring_sqe *sqe = _dvb_sub_reactor_get_sqe (priv);
+
+  io_uring_prep_cancel (sqe, user_data, IORING_ASYNC_CANCEL_ALL);
+  io_uring_sqe_set_data (sqe, NULL);
+}
+
+/* Queues reads for any file source that has free buffers to read into */
+static void
+_dvb_sub_reactor_queue_file_reads (DvbSubReactorPrivate * priv)
+{
+  DvbSubReactorSource *source;
+  DvbSubReactorRead *file_read;
+  struct io_uring_sqe *sqe;
+  GSList *l;
+
+  for (l = priv->files; l && priv->free_file_buffers; l = l->next) {
+    source = l->data;
+
+    while (!source->eof && source->in_flight < DVB_SUB_REACTOR_FILE_QUEUE_DEPTH
+        && priv->free_file_buffers) {
+      file_read = g_slice_new (DvbSubReactorRead);
+      file_read->type = DVB_SUB_REACTOR_SOURCE_FILE_READ;
+      file_read->source = source;
+      file_read->seq = source->next_seq++;
+      file_read->buffer = g_bit_nth_lsf (priv->free_file_buffers, -1);
+      file_read->len = 0;
+      priv->free_file_buffers &= ~(1U << file_read->buffer);
+
+      sqe = _dvb_sub_reactor_get_sqe (priv);
+      io_uring_prep_read_fixed (sqe, source->fd,
+          priv->file_buffers +
+          file_read->buffer * DVB_SUB_REACTOR_FILE_BUFFER_SIZE,
+          DVB_SUB_REACTOR_FILE_BUFFER_SIZE, source->offset, file_read->buffer);
+      io_uring_sqe_set_data (sqe, file_read);
+
+      source->offset += DVB_SUB_REACTOR_FILE_BUFFER_SIZE;
+      source->in_flight++;
+    }
+  }
+}
+
+static gint
+_dvb_sub_reactor_read_compare (gconstpointer a, gconstpointer b)
+{
+  return (gint) ((const DvbSubReactorRead *) a)->seq -
+      (gint) ((const DvbSubReactorRead *) b)->seq;
+}
+
+static void
+_dvb_sub_reactor_handle_demux (DvbSubReactor * reactor,
+    DvbSubReactorSource * source, struct io_uring_cqe *cqe, gint * dispatched)
+{
+  DvbSubReactorPrivate *priv = (DvbSubReactorPrivate *) reactor->private_data;
+  guint8 *buf;
+  guint bid;
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    buf = priv->demux_buffers + bid * DVB_SUB_REACTOR_DEMUX_BUFFER_SIZE;
+
+    if (cqe->res > 0 && source->dvb_sub) {
+      DvbSub *dvb_sub = g_object_ref (source->dvb_sub);
+
+      dvb_sub_feed_stream (dvb_sub, buf, cqe->res);
+      g_object_unref (dvb_sub);
+      (*dispatched)++;
+    }
+
+    /* Hand the buffer straight back to the kernel */
+    io_uring_buf_ring_add (priv->demux_ring, buf,
+        DVB_SUB_REACTOR_DEMUX_BUFFER_SIZE, bid,
+        io_uring_buf_ring_mask (DVB_SUB_REACTOR_DEMUX_BUFFERS), 0);
+    io_uring_buf_ring_advance (priv->demux_ring, 1);
+  }
+
+  if (cqe->flags & IORING_CQE_F_MORE)
+    return;
+
+  /* The multishot read has terminated */
+  source->armed = FALSE;
+  if (!source->dvb_sub) {
+    _dvb_sub_reactor_source_free (priv, source);
+    return;
+  }
+
+  switch (-cqe->res) {
+    case 0:
+    case ENOBUFS:                /* we fell behind and ran out of buffers */
+    case EOVERFLOW:              /* the demux ring buffer overflowed */
+    case EINTR:
+    case EAGAIN:
+      _dvb_sub_reactor_arm_demux (priv, source);
+      break;
+    default:
+      g_warning
+          ("Error during demux file descriptor read. Code: %d, message: %s",
+          -cqe->res, strerror (-cqe->res));
+      break;
+  }
+}
+
+static void
+_dvb_sub_reactor_handle_file_read (DvbSubReactor * reactor,
+    DvbSubReactorRead * file_read, struct io_uring_cqe *cqe, gint * dispatched)
+{
+  DvbSubReactorPrivate *priv = (DvbSubReactorPrivate *) reactor->private_data;
+  DvbSubReactorSource *source = file_read->source;
+  DvbSub *dvb_sub;
+
+  if (cqe->res < 0) {
+    if (source->dvb_sub && !source->failed)
+      g_warning ("Error during file read. Code: %d, message: %s", -cqe->res,
+          strerror (-cqe->res));
+    source->failed = TRUE;
+    source->eof = TRUE;
+    file_read->len = -1;
+  } else {
+    file_read->len = cqe->res;
+    if (cqe->res < DVB_SUB_REACTOR_FILE_BUFFER_SIZE)
+      source->eof = TRUE;
+  }
+
+  source->completed = g_slist_insert_sorted (source->completed, file_read,
+      _dvb_sub_reactor_read_compare);
+
+  /* Feed the data in file order, as far as it is contiguous */
+  while (source->completed &&
+      ((DvbSubReactorRead *) source->completed->data)->seq ==
+      source->feed_seq) {
+    file_read = source->completed->data;
+    source->completed = g_slist_delete_link (source->completed,
+        source->completed);
+    source->feed_seq++;
+
+    /* Reads already in flight beyond a failed one would join the data
+     * across the hole, so nothing after it is fed */
+    if (file_read->len < 0)
+      source->gap = TRUE;
+
+    if (file_read->len > 0 && !source->gap && source->dvb_sub) {
+      dvb_sub = g_object_ref (source->dvb_sub);
+      dvb_sub_feed_stream (dvb_sub, priv->file_buffers +
+          file_read->buffer * DVB_SUB_REACTOR_FILE_BUFFER_SIZE,
+          file_read->len);
+      g_object_unref (dvb_sub);
+      (*dispatched)++;
+    }
+
+    priv->free_file_buffers |= 1U << file_read->buffer;
+    g_slice_free (DvbSubReactorRead, file_read);
+  }
+
+  /* Only now, so that a removal from the callbacks above leaves freeing the
+   * source to us */
+  source->in_flight--;
+
+  _dvb_sub_reactor_queue_file_reads (priv);
+
+  if (!source->eof || source->in_flight > 0)
+    return;
+
+  /* Completely read - or given up on */
+  priv->files = g_slist_remove (priv->files, source);
+
+  if (source->dvb_sub) {
+    dvb_sub = g_object_ref (source->dvb_sub);
+    source->dvb_sub = NULL;
+    g_hash_table_remove (priv->subs, dvb_sub);
+    if (source->done_func)
+      source->done_func (reactor, dvb_sub, !source->failed, source->done_data);
+    g_object_unref (dvb_sub);
+  }
+
+  _dvb_sub_reactor_source_free (priv, source);
+}
+
+static gint
+_dvb_sub_reactor_dispatch_uring (DvbSubReactor * reactor, gint timeout)
+{
+  DvbSubReactorPrivate *priv = (DvbSubReactorPrivate *) reactor->private_data;
+  struct io_uring_cqe *cqe;
+  struct __kernel_timespec ts;
+  DvbSubReactorSourceType *type;
+  unsigned head, count = 0;
+  gint ret, dispatched = 0;
+
+  if (timeout != 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    ret = io_uring_submit_and_wait_timeout (&priv->ring, &cqe, 1,
+        timeout < 0 ? NULL : &ts, NULL);
+  } else {
+    ret = io_uring_submit (&priv->ring);
+  }
+
+  if (ret < 0 && ret != -ETIME && ret != -EINTR) {
+    g_warning ("io_uring wait failed: %s", strerror (-ret));
+    return -1;
+  }
+
+  io_uring_for_each_cqe (&priv->ring, head, cqe) {
+    count++;
+
+    type = io_uring_cqe_get_data (cqe);
+    if (!type)                  /* a cancellation request */
+      continue;
+
+    if (*type == DVB_SUB_REACTOR_SOURCE_DEMUX)
+      _dvb_sub_reactor_handle_demux (reactor,
+          (DvbSubReactorSource *) type, cqe, &dispatched);
+    else
+      _dvb_sub_reactor_handle_file_read (reactor,
+          (DvbSubReactorRead *) type, cqe, &dispatched);
+  }
+  io_uring_cq_advance (&priv->ring, count);
+
+  /* Submit the reads queued into freed file buffers along with any re-armed
+   * demux reads right away */
+  io_uring_submit (&priv->ring);
+
+  return dispatched;
+}
+#endif
+
+/* Detaches source from its DvbSub and frees it as soon as no I/O is in flight
+ * for it anymore. The caller removes it from priv->subs */
+static void
+_dvb_sub_reactor_source_remove (DvbSubReactorPrivate * priv,
+    DvbSubReactorSource * source)
+{
+  source->dvb_sub = NULL;
+
+#ifdef HAVE_LIBURING
+  if (priv->backend == DVB_SUB_REACTOR_BACKEND_IO_URING) {
+    /* Reads in flight still complete into our buffers, so the source is
+     * freed only once the last of them is in */
+    if (source->type == DVB_SUB_REACTOR_SOURCE_DEMUX) {
+      if (source->armed) {
+        _dvb_sub_reactor_cancel (priv, source);
+        io_uring_submit (&priv->ring);
+      } else {
+        _dvb_sub_reactor_source_free (priv, source);
+      }
+    } else {
+      /* Stop queueing reads; the ones in flight are let complete, as
+       * cancelling them would not free their buffers any sooner */
+      source->eof = TRUE;
+      priv->files = g_slist_remove (priv->files, source);
+      if (source->in_flight == 0)
+        _dvb_sub_reactor_source_free (priv, source);
+    }
+  } else
+#endif
+  {
+    epoll_ctl (priv->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    _dvb_sub_reactor_source_free (priv, source);
+  }
+}
+
+/**
+ * dvb_sub_reactor_new:
+ *
+ * Creates a new #DvbSubReactor, backed by epoll.
+ *
+ * Return value: a newly created #DvbSubReactor
+ */
+DvbSubReactor *
+dvb_sub_reactor_new (void)
+{
+  return dvb_sub_reactor_new_with_backend (DVB_SUB_REACTOR_BACKEND_EPOLL);
+}
+
+/**
+ * dvb_sub_reactor_new_with_backend:
+ * @backend: the #DvbSubReactorBackend to use
+ *
+ * Creates a new #DvbSubReactor with the given backend. If the io_uring backend
+ * is requested, but libdvbsub was built without it or the kernel does not
+ * support it, the reactor falls back to epoll. Use
+ * dvb_sub_reactor_get_backend() to find out which one is in use.
+ *
+ * Return value: a newly created #DvbSubReactor
+ */
+DvbSubReactor *
+dvb_sub_reactor_new_with_backend (DvbSubReactorBackend backend)
+{
+  DvbSubReactor *reactor = g_object_new (DVB_TYPE_SUB_REACTOR, NULL);
+  DvbSubReactorPrivate *priv = (DvbSubReactorPrivate *) reactor->private_data;
+
+#ifdef HAVE_LIBURING
+  if (backend == DVB_SUB_REACTOR_BACKEND_IO_URING &&
+      _dvb_sub_reactor_init_uring (priv))
+    return reactor;
+#else
+  if (backend == DVB_SUB_REACTOR_BACKEND_IO_URING)
+    g_warning ("libdvbsub was built without io_uring support, using epoll");
+#endif
+
+  _dvb_sub_reactor_init_epoll (priv);
+
+  return reactor;
+}
+
+/**
+ * dvb_sub_reactor_get_backend:
+ * @reactor: a #DvbSubReactor
+ *
+ * Gets the backend @reactor reads its data with.
+ *
+ * Return value: the #DvbSubReactorBackend in use
+ */
+DvbSubReactorBackend
+dvb_sub_reactor_get_backend (DvbSubReactor * reactor)
+{
+  g_return_val_if_fail (reactor != NULL, DVB_SUB_REACTOR_BACKEND_EPOLL);
+  g_return_val_if_fail (DVB_IS_SUB_REACTOR (reactor),
+      DVB_SUB_REACTOR_BACKEND_EPOLL);
+
+  return ((DvbSubReactorPrivate *) reactor->private_data)->backend;
+}
+
+/**
+ * dvb_sub_reactor_add:
+ * @reactor: a #DvbSubReactor
+ * @dvb_sub: a #DvbSub with a PID opened with dvb_sub_open_pid()
+ *
+ * Adds the demux file descriptor of @dvb_sub to the set read by @reactor.
+ * The reactor holds a reference to @dvb_sub until it is removed with
+ * dvb_sub_reactor_remove(), which must be done before closing the PID.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+dvb_sub_reactor_add (DvbSubReactor * reactor, DvbSub * dvb_sub)
+{
+  DvbSubReactorPrivate *priv;
+  DvbSubReactorSource *source;
+  struct epoll_event event = { 0, };
+  int fd;
+
+  g_return_val_if_fail (reactor != NULL, FALSE);
+  g_return_val_if_fail (DVB_IS_SUB_REACTOR (reactor), FALSE);
+  g_return_val_if_fail (dvb_sub != NULL, FALSE);
+  g_return_val_if_fail (DVB_IS_SUB (dvb_sub), FALSE);
+
+  priv = (DvbSubReactorPrivate *) reactor->private_data;
+  fd = dvb_sub_get_fd (dvb_sub);
+
+  g_return_val_if_fail (fd >= 0, FALSE);
+  g_return_val_if_fail (g_hash_table_lookup (priv->subs, dvb_sub) == NULL,
+      FALSE);
+
+  source = g_slice_new0 (DvbSubReactorSource);
+  source->type = DVB_SUB_REACTOR_SOURCE_DEMUX;
+  priv->n_sources++;
+  source->dvb_sub = dvb_sub;
+  source->fd = fd;
+
+#ifdef HAVE_LIBURING
+  if (priv->backend == DVB_SUB_REACTOR_BACKEND_IO_URING) {
+    _dvb_sub_reactor_arm_demux (priv, source);
+    io_uring_submit (&priv->ring);
+  } else
+#endif
+  {
+    event.events = EPOLLIN;
+    event.data.ptr = dvb_sub;
+
+    if (epoll_ctl (priv->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      perror ("epoll_ctl EPOLL_CTL_ADD");
+      _dvb_sub_reactor_source_free (priv, source);
+      return FALSE;
+    }
+  }
+
+  g_hash_table_insert (priv->subs, g_object_ref (dvb_sub), source);
+
+  return TRUE;
+}
+
+/**
+ * dvb_sub_reactor_add_file:
+ * @reactor: a #DvbSubReactor using %DVB_SUB_REACTOR_BACKEND_IO_URING
+ * @dvb_sub: a #DvbSub to feed the file to
+ * @filename: a file containing a recorded PES stream of subtitles
+ * @done_func: function to call when the whole file has been fed, or %NULL
+ * @user_data: user data for @done_func
+ *
+ * Reads @filename asynchronously and feeds it to @dvb_sub with
+ * dvb_sub_feed_stream(), as the reads complete during
+ * dvb_sub_reactor_dispatch(). Several large reads are kept in flight at a
+ * time, into buffers registered with the kernel once per reactor. The reactor
+ * holds a reference to @dvb_sub until the file is done or it is removed with
+ * dvb_sub_reactor_remove(). A #DvbSub can only be added to a reactor once at
+ * a time, be it with a file or its demux file descriptor.
+ *
+ * Only available with the io_uring backend; transport stream recordings
+ * should be fed with dvb_sub_feed_ts() or through a #DvbSubMux instead.
+ *
+ * Return value: %TRUE if the file is being read, %FALSE on error
+ */
+gboolean
+dvb_sub_reactor_add_file (DvbSubReactor * reactor, DvbSub * dvb_sub,
+    const gchar * filename, DvbSubReactorFileFunc done_func,
+    gpointer user_data)
+{
+  DvbSubReactorPrivate *priv;
+
+  g_return_val_if_fail (reactor != NULL, FALSE);
+  g_return_val_if_fail (DVB_IS_SUB_REACTOR (reactor), FALSE);
+  g_return_val_if_fail (dvb_sub != NULL, FALSE);
+  g_return_val_if_fail (DVB_IS_SUB (dvb_sub), FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  priv = (DvbSubReactorPrivate *) reactor->private_data;
+
+  g_return_val_if_fail (g_hash_table_lookup (priv->subs, dvb_sub) == NULL,
+      FALSE);
+
+#ifdef HAVE_LIBURING
+  if (priv->backend == DVB_SUB_REACTOR_BACKEND_IO_URING) {
+    DvbSubReactorSource *source;
+    struct iovec iov[DVB_SUB_REACTOR_FILE_BUFFERS];
+    gint fd, i, ret;
+
+    if (!priv->file_buffers) {
+      priv->file_buffers = g_malloc (DVB_SUB_REACTOR_FILE_BUFFERS *
+          DVB_SUB_REACTOR_FILE_BUFFER_SIZE);
+      for (i = 0; i < DVB_SUB_REACTOR_FILE_BUFFERS; ++i) {
+        iov[i].iov_base =
+            priv->file_buffers + i * DVB_SUB_REACTOR_FILE_BUFFER_SIZE;
+        iov[i].iov_len = DVB_SUB_REACTOR_FILE_BUFFER_SIZE;
+      }
+
+      ret = io_uring_register_buffers (&priv->ring, iov,
+          DVB_SUB_REACTOR_FILE_BUFFERS);
+      if (ret < 0) {
+        g_warning ("Failed to register io_uring file buffers: %s",
+            strerror (-ret));
+        g_free (priv->file_buffers);
+        priv->file_buffers = NULL;
+        return FALSE;
+      }
+      priv->free_file_buffers = (1U << DVB_SUB_REACTOR_FILE_BUFFERS) - 1;
+    }
+
+    fd = TEMP_FAILURE_RETRY (open (filename, O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+      perror (filename);
+      return FALSE;
+    }
+
+    source = g_slice_new0 (DvbSubReactorSource);
+    source->type = DVB_SUB_REACTOR_SOURCE_FILE;
+    priv->n_sources++;
+    source->dvb_sub = dvb_sub;
+    source->fd = fd;
+    source->done_func = done_func;
+    source->done_data = user_data;
+
+    g_hash_table_insert (priv->subs, g_object_ref (dvb_sub), source);
+    priv->files = g_slist_append (priv->files, source);
+
+    _dvb_sub_reactor_queue_file_reads (priv);
+    io_uring_submit (&priv->ring);
+
+    return TRUE;
+  }
+#endif
+
+  g_warning ("Reading files with a DvbSubReactor needs the io_uring backend");
+  return FALSE;
+}
+
+/**
+ * dvb_sub_reactor_remove:
+ * @reactor: a #DvbSubReactor
+ * @dvb_sub: a #DvbSub previously added with dvb_sub_reactor_add() or
+ *   dvb_sub_reactor_add_file()
+ *
+ * Removes @dvb_sub from @reactor and drops the reference to it. It is safe to
+ * call this from within the callbacks of a #DvbSub being dispatched. For a
+ * file, the remaining data is not fed and the done function is not called.
+ */
+void
+dvb_sub_reactor_remove (DvbSubReactor * reactor, DvbSub * dvb_sub)
+{
+  DvbSubReactorPrivate *priv;
+  DvbSubReactorSource *source;
+
+  g_return_if_fail (reactor != NULL);
+  g_return_if_fail (DVB_IS_SUB_REACTOR (reactor));
+
+  priv = (DvbSubReactorPrivate *) reactor->private_data;
+
+  source = g_hash_table_lookup (priv->subs, dvb_sub);
+  g_return_if_fail (source != NULL);
+
+  _dvb_sub_reactor_source_remove (priv, source);
+  g_hash_table_remove (priv->subs, dvb_sub);
+}
+
+/**
+ * dvb_sub_reactor_get_fd:
+ * @reactor: a #DvbSubReactor
+ *
+ * Gets the file descriptor that becomes readable whenever @reactor has data
+ * to dispatch. It should not be read from directly, but
+ * dvb_sub_reactor_dispatch() called instead.
+ *
+ * Return value: the epoll or io_uring file descriptor of @reactor, -1 on error
+ */
+int
+dvb_sub_reactor_get_fd (DvbSubReactor * reactor)
+{
+  DvbSubReactorPrivate *priv;
+
+  g_return_val_if_fail (reactor != NULL, -1);
+  g_return_val_if_fail (DVB_IS_SUB_REACTOR (reactor), -1);
+
+  priv = (DvbSubReactorPrivate *) reactor->private_data;
+
+#ifdef HAVE_LIBURING
+  if (priv->backend == DVB_SUB_REACTOR_BACKEND_IO_URING)
+    return priv->ring.ring_fd;
+#endif
+
+  return priv->epoll_fd;
+}
+
+/**
+ * dvb_sub_reactor_dispatch:
+ * @reactor: a #DvbSubReactor
+ * @timeout: maximum time to wait for data in milliseconds, 0 to not wait
+ *   and -1 to wait indefinitely
+ *
+ * Waits for any of the sources of @reactor to have data available, and feeds
+ * all the available data to the #DvbSub instances they belong to.
+ *
+ * Return value: the amount of demux file descriptors read or, with the
+ *   io_uring backend, buffers fed; -1 on error
+ */
+gint
+dvb_sub_reactor_dispatch (DvbSubReactor * reactor, gint timeout)
+{
+  DvbSubReactorPrivate *priv;
+  struct epoll_event events[DVB_SUB_REACTOR_MAX_EVENTS];
+  DvbSub *dvb_sub;
+  gint n_events, i, dispatched = 0;
+
+  g_return_val_if_fail (reactor != NULL, -1);
+  g_return_val_if_fail (DVB_IS_SUB_REACTOR (reactor), -1);
+
+  priv = (DvbSubReactorPrivate *) reactor->private_data;
+
+#ifdef HAVE_LIBURING
+  if (priv->backend == DVB_SUB_REACTOR_BACKEND_IO_URING) {
+    dispatched = _dvb_sub_reactor_dispatch_uring (reactor, timeout);
+    dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_DEBUG,
+        "Reactor dispatched %d io_uring buffers", dispatched);
+    return dispatched;
+  }
+#endif
+
+  do {
+    n_events = TEMP_FAILURE_RETRY (epoll_wait (priv->epoll_fd, events,
+            DVB_SUB_REACTOR_MAX_EVENTS, timeout));
+    if (n_events < 0) {
+      perror ("epoll_wait");
+      return -1;
+    }
+
+    for (i = 0; i < n_events; ++i) {
+      dvb_sub = events[i].data.ptr;
+
+      /* An earlier callback in this batch may have removed it */
+      if (!g_hash_table_lookup (priv->subs, dvb_sub))
+        continue;
+
+      g_object_ref (dvb_sub);
+      if (dvb_sub_get_fd (dvb_sub) >= 0) {
+        dvb_sub_read_data (dvb_sub);
+        dispatched++;
+      }
+      g_object_unref (dvb_sub);
+    }
+
+    /* A full batch means more descriptors may be ready - fetch them too */
+    timeout = 0;
+  } while (n_events == DVB_SUB_REACTOR_MAX_EVENTS);
+
+  dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_DEBUG,
+      "Reactor dispatched %d demux file descriptors", dispatched);
+
+  return dispatched;
+}
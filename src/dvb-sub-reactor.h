@@ -0,0 +1,99 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * libdvbsub - DVB subtitle decoding
+ * Copyright (C) Mart Raudsepp 2009 <mart.raudsepp@artecdesign.ee>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DVB_SUB_REACTOR_H_
+#define _DVB_SUB_REACTOR_H_
+
+#include <glib-object.h>
+#include "dvb-sub.h"
+
+G_BEGIN_DECLS
+
+#define DVB_TYPE_SUB_REACTOR             (dvb_sub_reactor_get_type ())
+#define DVB_SUB_REACTOR(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj), DVB_TYPE_SUB_REACTOR, DvbSubReactor))
+#define DVB_SUB_REACTOR_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST ((klass), DVB_TYPE_SUB_REACTOR, DvbSubReactorClass))
+#define DVB_IS_SUB_REACTOR(obj)          (G_TYPE_CHECK_INSTANCE_TYPE ((obj), DVB_TYPE_SUB_REACTOR))
+#define DVB_IS_SUB_REACTOR_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE ((klass), DVB_TYPE_SUB_REACTOR))
+#define DVB_SUB_REACTOR_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS ((obj), DVB_TYPE_SUB_REACTOR, DvbSubReactorClass))
+
+typedef struct _DvbSubReactorClass DvbSubReactorClass;
+typedef struct _DvbSubReactor DvbSubReactor;
+
+struct _DvbSubReactorClass
+{
+	GObjectClass parent_class;
+};
+
+/**
+ * DvbSubReactor:
+ *
+ * The #DvbSubReactor struct contains only private fields and should not be
+ * directly accessed.
+ */
+struct _DvbSubReactor
+{
+	GObject parent_instance;
+
+	/*< private >*/
+	gpointer private_data;
+};
+
+/**
+ * DvbSubReactorBackend:
+ * @DVB_SUB_REACTOR_BACKEND_EPOLL: demux file descriptors are polled with epoll
+ *   and read with read()
+ * @DVB_SUB_REACTOR_BACKEND_IO_URING: demux file descriptors are read with
+ *   multishot io_uring reads into kernel registered buffers, and files can be
+ *   read asynchronously with dvb_sub_reactor_add_file(). Only available if
+ *   libdvbsub was built with liburing.
+ *
+ * The ways a #DvbSubReactor can read its data.
+ */
+typedef enum {
+	DVB_SUB_REACTOR_BACKEND_EPOLL,
+	DVB_SUB_REACTOR_BACKEND_IO_URING
+} DvbSubReactorBackend;
+
+/**
+ * DvbSubReactorFileFunc:
+ * @reactor: the #DvbSubReactor
+ * @dvb_sub: the #DvbSub the file was fed to
+ * @success: %FALSE if reading the file failed before its end
+ * @user_data: user data as passed to dvb_sub_reactor_add_file()
+ *
+ * Called when a file added with dvb_sub_reactor_add_file() has been fully
+ * read and parsed, right before @reactor releases its reference to @dvb_sub.
+ */
+typedef void (*DvbSubReactorFileFunc) (DvbSubReactor *reactor, DvbSub *dvb_sub, gboolean success, gpointer user_data);
+
+GType                dvb_sub_reactor_get_type         (void) G_GNUC_CONST;
+DvbSubReactor       *dvb_sub_reactor_new              (void);
+DvbSubReactor       *dvb_sub_reactor_new_with_backend (DvbSubReactorBackend backend);
+DvbSubReactorBackend dvb_sub_reactor_get_backend      (DvbSubReactor *reactor);
+gboolean             dvb_sub_reactor_add              (DvbSubReactor *reactor, DvbSub *dvb_sub);
+gboolean             dvb_sub_reactor_add_file         (DvbSubReactor *reactor, DvbSub *dvb_sub, const gchar *filename,
+                                                       DvbSubReactorFileFunc done_func, gpointer user_data);
+void                 dvb_sub_reactor_remove           (DvbSubReactor *reactor, DvbSub *dvb_sub);
+int                  dvb_sub_reactor_get_fd           (DvbSubReactor *reactor);
+gint                 dvb_sub_reactor_dispatch         (DvbSubReactor *reactor, gint timeout);
+
+G_END_DECLS
+
+#endif /* _DVB_SUB_REACTOR_H_ */
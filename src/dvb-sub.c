@@ -33,9 +33,15 @@
 #include "dvb-sub.h"
 #include <string.h>             /* memset */
 #include <gst/gstutils.h>       /* GST_READ_UINT16_BE */
-#include <gst/base/gstbitreader.h>      /* GstBitReader */
 #include "ffmpeg-colorspace.h"  /* YUV_TO_RGB1_CCIR */
 #include "dvb-log.h"
+#include "dvb-ringbuffer.h"
+#include "dvb-arena.h"
+#include "dvb-bufferpool.h"
+#include "dvb-demux.h"
+#include "dvb-simd.h"
+#include "dvb-bitreader.h"
+#include "dvb-color.h"
 
 //#define DEBUG_SAVE_IMAGES /* NOTE: This requires netpbm on the system - pnmtopng is called with system() */
 
@@ -59,15 +65,27 @@ static guint8 ff_cropTbl[256 + 2 * MAX_NEG_CROP] = { 0, };
 /* FIXME: This is really ARGB... We might need this configurable for performant
  * FIXME: use in GStreamer as well if that likes RGBA more (Qt prefers ARGB) */
 #define RGBA(r,g,b,a) (((a) << 24) | ((r) << 16) | ((g) << 8) | (b))
+#define AYUV(y,u,v,a) (((a) << 24) | ((y) << 16) | ((u) << 8) | (v))
 
 typedef struct DVBSubCLUT
 {
   int id;                       /* default_clut uses -1 for this, so guint8 isn't fine without adaptations first */
+  int version;                  /* -1 until a CLUT definition segment has been parsed */
 
   guint32 clut4[4];
   guint32 clut16[16];
   guint32 clut256[256];
 
+  /* The entries as coded, before conversion to RGB; BT.601 studio range */
+  guint32 yuv4[4];
+  guint32 yuv16[16];
+  guint32 yuv256[256];
+
+  /* Shared snapshots of the above handed out as subtitle palettes, made on
+   * demand and dropped when the CLUT changes */
+  guint32 *palettes[3];
+  guint32 *yuv_palettes[3];     /* in the colour matrix of the output */
+
   struct DVBSubCLUT *next;
 } DVBSubCLUT;
 
@@ -96,10 +114,10 @@ typedef struct DVBSubObject
   int id;                       /* FIXME: Use guint8 after checking it's fine in all code using it */
 
   int type;
+  int version;                  /* -1 until an object data segment has been parsed */
 
   /* FIXME: Should we use GSList? */
   DVBSubObjectDisplay *display_list;
-  struct DVBSubObject *next;
 } DVBSubObject;
 
 typedef struct DVBSubRegionDisplay
@@ -112,6 +130,32 @@ typedef struct DVBSubRegionDisplay
   struct DVBSubRegionDisplay *next;
 } DVBSubRegionDisplay;
 
+/* A rectangle spanning x0 <= x < x1, y0 <= y < y1; empty if x1 <= x0 */
+typedef struct DvbSubBox
+{
+  gint x0, y0;
+  gint x1, y1;
+} DvbSubBox;
+
+static void
+_dvb_sub_box_add (DvbSubBox * box, gint x0, gint y0, gint x1, gint y1)
+{
+  if (x1 <= x0 || y1 <= y0)
+    return;
+
+  if (box->x1 <= box->x0) {
+    box->x0 = x0;
+    box->y0 = y0;
+    box->x1 = x1;
+    box->y1 = y1;
+  } else {
+    box->x0 = MIN (box->x0, x0);
+    box->y0 = MIN (box->y0, y0);
+    box->x1 = MAX (box->x1, x1);
+    box->y1 = MAX (box->y1, y1);
+  }
+}
+
 typedef struct DVBSubRegion
 {
   guint8 id;
@@ -122,15 +166,48 @@ typedef struct DVBSubRegion
   guint8 clut;
   guint8 bgcolor;
 
+  int version;                  /* version of the last parsed region composition segment */
+
   /* FIXME: Validate these fields existence and exact types */
   guint8 *pbuf;
   int buf_size;
+  int stride;                   /* width padded to the rowstride alignment */
+
+  DvbSubBox dirty;              /* area drawn into since the last display set */
 
   DVBSubObjectDisplay *display_list;
 
   struct DVBSubRegion *next;
 } DVBSubRegion;
 
+/* A decoded object pixmap, kept for as long as the same coded data keeps
+ * being repeated in object segments */
+typedef struct DVBSubObjectCacheEntry
+{
+  guint16 object_id;
+  guint8 depth;
+  guint32 hash;
+
+  /* Copy of the coded field data, to verify hash matches */
+  guint8 *data;
+  gint data_len;
+  gint data_size;
+  guint16 top_field_len;
+
+  /* Both fields interleaved, width bytes per line */
+  gint width;
+  gint height;
+  guint8 *pbuf;
+  gint pbuf_size;
+  gint *line_lens;              /* pixels decoded per line */
+  gint line_lens_size;
+
+  struct DVBSubObjectCacheEntry *next;
+} DVBSubObjectCacheEntry;
+
+/* Maximum number of decoded object pixmaps kept around */
+#define DVB_SUB_OBJECT_CACHE_SIZE 16
+
 typedef struct _DvbSubPrivate DvbSubPrivate;
 struct _DvbSubPrivate
 {
@@ -139,20 +216,61 @@ struct _DvbSubPrivate
   gpointer user_data;
 
   guint8 page_time_out;
+  /* Holds the regions, CLUTs, objects and displays of the current epoch */
+  DvbArena arena;
+  /* Recycles region pixel buffers and their copies handed out as subtitles */
+  DvbBufferPool buffer_pool;
+  guint32 *default_palettes[3];   /* snapshots of default_clut */
+  guint32 *default_yuv_palettes[3];
+  gboolean yuv_palette;         /* whether to hand out YUV palettes too */
+  DVBSubtitleColorMatrix color_matrix;
+  DvbSubAllocator allocator;    /* for region pixel buffers, if alloc is set */
+  gpointer allocator_data;
+  gboolean contiguous_output;
+  gboolean trim_transparent;
+
+  /* Regions of the last display set handed out, and the rects they were
+   * shown in */
+  guint32 shown_regions[8];
+  gint shown_x[256];
+  gint shown_y[256];
+  gint shown_w[256];
+  gint shown_h[256];
   DVBSubRegion *region_list;
   DVBSubCLUT *clut_list;
-  DVBSubObject *object_list;
+  /* Region and CLUT ids are 8-bit, so these are indexed directly by id */
+  DVBSubRegion *regions[256];
+  DVBSubCLUT *cluts[256];
+  /* Open addressed hash table of the objects, with linear probing */
+  DVBSubObject **object_table;
+  guint object_table_bits;
+  guint n_objects;
   /* FIXME... */
   int display_list_size;
   DVBSubRegionDisplay *display_list;
-  GString *pes_buffer;
+  DvbRingBuffer pes_buffer;
+  DvbPesAssembler ts_pes;
   DVBSubtitleWindow display_def;
+  DVBSubObjectCacheEntry *object_cache; /* most recently used first */
+  gint object_cache_len;
+  gint page_version;            /* -1 if no page composition is in effect */
+  gboolean display_set_changed; /* since the last end of display set */
+  gint composition_page_id;     /* -1 to decode all pages */
+  gint ancillary_page_id;       /* -1 for none */
 };
 
+/* Capacity of the PES accumulation ring used by dvb_sub_read_data(). Needs to
+ * be big enough to hold a backlog of several maximum sized PES packets */
+#define DVB_SUB_PES_BUFFER_SIZE (256 * 1024)
+
 #define DVB_SUB_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), DVB_TYPE_SUB, DvbSubPrivate))
 
 G_DEFINE_TYPE (DvbSub, dvb_sub, G_TYPE_OBJECT);
 
+static void _dvb_sub_ts_pes_func (guint64 pts, guint8 * data, gint len,
+    gpointer user_data);
+static void _dvb_sub_init_4bit_codes (void);
+
 typedef enum
 {
   TOP_FIELD = 0,
@@ -160,30 +278,99 @@ typedef enum
 } DvbSubPixelDataSubBlockFieldType;
 
 /* FIXME: It might make sense to pass DvbSubPrivate for all the get_* functions, instead of public DvbSub */
+#define OBJECT_HASH(id, bits) (((guint32) (id) * 2654435761U) >> (32 - (bits)))
+
 static DVBSubObject *
 get_object (DvbSub * dvb_sub, guint16 object_id)
 {
   const DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
-  DVBSubObject *ptr = priv->object_list;
+  guint mask, i;
+
+  if (!priv->object_table)
+    return NULL;
+
+  mask = (1 << priv->object_table_bits) - 1;
+  for (i = OBJECT_HASH (object_id, priv->object_table_bits);
+      priv->object_table[i]; i = (i + 1) & mask) {
+    if (priv->object_table[i]->id == object_id)
+      return priv->object_table[i];
+  }
+
+  return NULL;
+}
+
+static void
+_dvb_sub_insert_object (DvbSubPrivate * priv, DVBSubObject * object)
+{
+  guint mask, i;
+
+  mask = (1 << priv->object_table_bits) - 1;
+  for (i = OBJECT_HASH (object->id, priv->object_table_bits);
+      priv->object_table[i]; i = (i + 1) & mask);
 
-  while (ptr && ptr->id != object_id) {
-    ptr = ptr->next;
+  priv->object_table[i] = object;
+}
+
+static void
+add_object (DvbSub * dvb_sub, DVBSubObject * object)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  DVBSubObject **old_table;
+  guint old_size, i;
+
+  /* Keep the table at most half full so that probe sequences stay short */
+  if (!priv->object_table
+      || (priv->n_objects + 1) * 2 > (1U << priv->object_table_bits)) {
+    old_table = priv->object_table;
+    old_size = old_table ? 1 << priv->object_table_bits : 0;
+
+    priv->object_table_bits = old_table ? priv->object_table_bits + 1 : 4;
+    priv->object_table = g_new0 (DVBSubObject *, 1 << priv->object_table_bits);
+
+    for (i = 0; i < old_size; i++) {
+      if (old_table[i])
+        _dvb_sub_insert_object (priv, old_table[i]);
+    }
+    g_free (old_table);
   }
 
-  return ptr;
+  _dvb_sub_insert_object (priv, object);
+  priv->n_objects++;
+}
+
+static void
+remove_object (DvbSub * dvb_sub, DVBSubObject * object)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  guint mask, i, j, k;
+
+  mask = (1 << priv->object_table_bits) - 1;
+  for (i = OBJECT_HASH (object->id, priv->object_table_bits);
+      priv->object_table[i] != object; i = (i + 1) & mask)
+    g_assert (priv->object_table[i]);
+
+  /* Move following entries of the probe sequence back into the hole, so
+   * that lookups need no tombstones */
+  for (j = (i + 1) & mask; priv->object_table[j]; j = (j + 1) & mask) {
+    k = OBJECT_HASH (priv->object_table[j]->id, priv->object_table_bits);
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+      continue;
+    priv->object_table[i] = priv->object_table[j];
+    i = j;
+  }
+  priv->object_table[i] = NULL;
+  priv->n_objects--;
 }
 
 static DVBSubCLUT *
 get_clut (DvbSub * dvb_sub, gint clut_id)
 {
   const DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
-  DVBSubCLUT *ptr = priv->clut_list;
 
-  while (ptr && ptr->id != clut_id) {
-    ptr = ptr->next;
-  }
+  if (clut_id < 0 || clut_id >= G_N_ELEMENTS (priv->cluts))
+    return NULL;
 
-  return ptr;
+  return priv->cluts[clut_id];
 }
 
 // FIXME: Just pass private_data pointer directly here and in other get_* helper functions?
@@ -191,21 +378,15 @@ static DVBSubRegion *
 get_region (DvbSub * dvb_sub, guint8 region_id)
 {
   const DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
-  DVBSubRegion *ptr = priv->region_list;
-
-  while (ptr && ptr->id != region_id) {
-    ptr = ptr->next;
-  }
 
-  return ptr;
+  return priv->regions[region_id];
 }
 
 static void
 delete_region_display_list (DvbSub * dvb_sub, DVBSubRegion * region)
 {
-  const DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
-  DVBSubObject *object, *obj2;
-  DVBSubObject **obj2_ptr;
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  DVBSubObject *object;
   DVBSubObjectDisplay *display, *obj_disp, **obj_disp_ptr;
 
   while (region->display_list) {
@@ -226,25 +407,26 @@ delete_region_display_list (DvbSub * dvb_sub, DVBSubRegion * region)
         *obj_disp_ptr = obj_disp->object_list_next;
 
         if (!object->display_list) {
-          obj2_ptr = &priv->object_list;
-          obj2 = *obj2_ptr;
-
-          while (obj2 != object) {
-            g_assert (obj2);
-            obj2_ptr = &obj2->next;
-            obj2 = *obj2_ptr;
-          }
-
-          *obj2_ptr = obj2->next;
-
-          g_slice_free (DVBSubObject, obj2);
+          remove_object (dvb_sub, object);
+          dvb_arena_delete (&priv->arena, DVBSubObject, object);
         }
       }
     }
 
     region->display_list = display->region_list_next;
 
-    g_slice_free (DVBSubObjectDisplay, display);
+    dvb_arena_delete (&priv->arena, DVBSubObjectDisplay, display);
+  }
+}
+
+static void
+release_palettes (guint32 ** palettes)
+{
+  gint i;
+
+  for (i = 0; i < 3; i++) {
+    dvb_shared_buffer_unref (palettes[i]);
+    palettes[i] = NULL;
   }
 }
 
@@ -253,25 +435,54 @@ delete_state (DvbSub * dvb_sub)
 {
   DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
   DVBSubRegion *region;
+  DVBSubCLUT *clut;
 
-  while (priv->region_list) {
-    region = priv->region_list;
+  /* Buffers still used by subtitles stay around until those are unreffed */
+  for (region = priv->region_list; region; region = region->next)
+    dvb_buffer_pool_release (&priv->buffer_pool, region->pbuf);
 
-    priv->region_list = region->next;
+  for (clut = priv->clut_list; clut; clut = clut->next) {
+    release_palettes (clut->palettes);
+    release_palettes (clut->yuv_palettes);
+  }
 
-    delete_region_display_list (dvb_sub, region);
-    if (region->pbuf)
-      g_free (region->pbuf);
+  /* Everything else of the epoch goes away with the arena in one go */
+  dvb_arena_reset (&priv->arena);
 
-    g_slice_free (DVBSubRegion, region);
-  }
+  priv->region_list = NULL;
+  memset (priv->regions, 0, sizeof (priv->regions));
 
-  g_slice_free_chain (DVBSubCLUT, priv->clut_list, next);
   priv->clut_list = NULL;
+  memset (priv->cluts, 0, sizeof (priv->cluts));
+
+  if (priv->object_table)
+    memset (priv->object_table, 0,
+        sizeof (DVBSubObject *) << priv->object_table_bits);
+  priv->n_objects = 0;
+
+  priv->display_list = NULL;
+  priv->display_list_size = 0;
 
-  /* Should already be null */
-  if (priv->object_list)
-    g_warning ("Memory deallocation error!");
+  priv->page_version = -1;
+  priv->display_set_changed = TRUE;
+}
+
+static void
+_dvb_sub_object_cache_clear (DvbSub * dvb_sub)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  DVBSubObjectCacheEntry *entry;
+
+  while (priv->object_cache) {
+    entry = priv->object_cache;
+    priv->object_cache = entry->next;
+
+    g_free (entry->data);
+    g_free (entry->pbuf);
+    g_free (entry->line_lens);
+    g_slice_free (DVBSubObjectCacheEntry, entry);
+  }
+  priv->object_cache_len = 0;
 }
 
 static void
@@ -285,9 +496,17 @@ dvb_sub_init (DvbSub * self)
   /* FIXME: Do we have a reason to initiate the members to zero, or are we guaranteed that anyway? */
   priv->fd = -1;
   priv->region_list = NULL;
-  priv->object_list = NULL;
   priv->page_time_out = 0;      /* FIXME: Maybe 255 instead? */
-  priv->pes_buffer = g_string_new (NULL);
+  /* pes_buffer storage is allocated on demand in dvb_sub_open_pid() */
+  dvb_arena_init (&priv->arena);
+  dvb_buffer_pool_init (&priv->buffer_pool, DVB_BUFFER_POOL_DEFAULT_LIMIT);
+  dvb_pes_assembler_init (&priv->ts_pes, DVB_TS_PID_INVALID,
+      _dvb_sub_ts_pes_func, self);
+
+  priv->page_version = -1;
+  priv->display_set_changed = TRUE;
+  priv->composition_page_id = -1;
+  priv->ancillary_page_id = -1;
 
   /* display/window information */
   priv->display_def.version = -1;
@@ -306,7 +525,14 @@ dvb_sub_finalize (GObject * object)
   if (priv->fd >= 0)
     dvb_sub_close_pid (self);
   delete_state (self);          /* close_pid should have called this, but lets be sure */
-  g_string_free (priv->pes_buffer, TRUE);
+  dvb_ring_buffer_free (&priv->pes_buffer);
+  dvb_pes_assembler_clear (&priv->ts_pes);
+  dvb_arena_clear (&priv->arena);
+  release_palettes (priv->default_palettes);
+  release_palettes (priv->default_yuv_palettes);
+  dvb_buffer_pool_clear (&priv->buffer_pool);
+  _dvb_sub_object_cache_clear (self);
+  g_free (priv->object_table);
 
   G_OBJECT_CLASS (dvb_sub_parent_class)->finalize (object);
 }
@@ -336,11 +562,13 @@ dvb_sub_class_init (DvbSubClass * klass)
   g_type_class_add_private (klass, sizeof (DvbSubPrivate));
 
   dsputil_static_init ();       /* Initializes ff_cropTbl table, used in YUV_TO_RGB conversion */
+  _dvb_sub_init_4bit_codes ();
 
   /* Initialize the static default_clut structure, from which other clut
    * structures are initialized from (to start off with default CLUTs
    * as defined in the specification). */
   default_clut.id = -1;
+  default_clut.version = -1;
 
   default_clut.clut4[0] = RGBA (0, 0, 0, 0);
   default_clut.clut4[1] = RGBA (255, 255, 255, 255);
@@ -398,6 +626,18 @@ dvb_sub_class_init (DvbSubClass * klass)
     }
     default_clut.clut256[i] = RGBA (r, g, b, a);
   }
+
+  /* The default CLUT is defined in RGB, so its YUV entries are derived with
+   * BT.601 like the coded entries are meant */
+  for (i = 0; i < 4; i++)
+    default_clut.yuv4[i] = dvb_color_argb_to_ayuv (default_clut.clut4[i],
+        DVB_SUBTITLE_COLOR_MATRIX_BT601);
+  for (i = 0; i < 16; i++)
+    default_clut.yuv16[i] = dvb_color_argb_to_ayuv (default_clut.clut16[i],
+        DVB_SUBTITLE_COLOR_MATRIX_BT601);
+  for (i = 0; i < 256; i++)
+    default_clut.yuv256[i] = dvb_color_argb_to_ayuv (default_clut.clut256[i],
+        DVB_SUBTITLE_COLOR_MATRIX_BT601);
 }
 
 static void
@@ -411,6 +651,7 @@ _dvb_sub_parse_page_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
   const guint8 *buf_end = buf + buf_size;
   guint8 region_id;
   guint8 page_state;
+  gint page_version;
 
 #ifdef DEBUG
   static int counter = 0;
@@ -426,6 +667,7 @@ _dvb_sub_parse_page_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
     return;
 
   priv->page_time_out = *buf++;
+  page_version = (*buf) >> 4;
   page_state = ((*buf++) >> 2) & 3;
 
 #ifdef DEBUG
@@ -440,6 +682,14 @@ _dvb_sub_parse_page_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
     delete_state (dvb_sub);
   }
 
+  if (page_version == priv->page_version) {
+    dvb_log (DVB_LOG_PAGE, G_LOG_LEVEL_DEBUG,
+        "Page version %d unchanged, keeping the region list", page_version);
+    return;
+  }
+  priv->page_version = page_version;
+  priv->display_set_changed = TRUE;
+
   tmp_display_list = priv->display_list;
   priv->display_list = NULL;
   priv->display_list_size = 0;
@@ -457,7 +707,7 @@ _dvb_sub_parse_page_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
     }
 
     if (!display)
-      display = g_slice_new0 (DVBSubRegionDisplay);
+      display = dvb_arena_new0 (&priv->arena, DVBSubRegionDisplay);
 
     display->region_id = region_id;
 
@@ -482,8 +732,51 @@ _dvb_sub_parse_page_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
 
     tmp_display_list = display->next;
 
-    g_slice_free (DVBSubRegionDisplay, display);
+    dvb_arena_delete (&priv->arena, DVBSubRegionDisplay, display);
+  }
+}
+
+/* Region pixel buffers come from the allocator of the application if it has
+ * set one, else from the buffer pool. The data is aligned like the rows */
+static guint8 *
+_dvb_sub_alloc_region_buffer (DvbSub * dvb_sub, gsize size)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  guint8 *pbuf = NULL;
+
+  if (priv->allocator.alloc) {
+    pbuf = dvb_shared_buffer_new_full (size, priv->allocator.rowstride_align,
+        priv->allocator.alloc, priv->allocator.free, priv->allocator_data);
+    if (pbuf || size == 0)
+      return pbuf;
+    dvb_log (DVB_LOG_REGION, G_LOG_LEVEL_DEBUG,
+        "Allocator failed for %" G_GSIZE_FORMAT " bytes, using own memory",
+        size);
   }
+
+  return dvb_buffer_pool_alloc_shared (&priv->buffer_pool, size,
+      priv->allocator.rowstride_align);
+}
+
+/* The pixel buffers of regions are shared with the subtitles handed out
+ * and immutable while they are. Gives region a buffer of its own to draw
+ * into, with the current contents copied over if keep_contents */
+static void
+_dvb_sub_region_make_writable (DvbSub * dvb_sub, DVBSubRegion * region,
+    gboolean keep_contents)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  guint8 *pbuf;
+
+  if (!region->pbuf || !dvb_shared_buffer_is_shared (region->pbuf))
+    return;
+
+  pbuf = _dvb_sub_alloc_region_buffer (dvb_sub, region->buf_size);
+  if (keep_contents)
+    memcpy (pbuf, region->pbuf, region->buf_size);
+
+  dvb_buffer_pool_release (&priv->buffer_pool, region->pbuf);
+  region->pbuf = pbuf;
 }
 
 static void
@@ -499,6 +792,8 @@ _dvb_sub_parse_region_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
   DVBSubObject *object;
   DVBSubObjectDisplay *object_display;
   gboolean fill;
+  gint version, stride;
+  guint8 old_clut, old_depth;
 
   if (buf_size < 10)
     return;
@@ -507,13 +802,25 @@ _dvb_sub_parse_region_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
 
   region = get_region (dvb_sub, region_id);
 
+  version = (*buf) >> 4;
+  if (region && region->version == version) {
+    /* The version is updated whenever the fill flag is set, the CLUT family
+     * changes or the object list is not empty, so there's nothing to redo */
+    dvb_log (DVB_LOG_REGION, G_LOG_LEVEL_DEBUG,
+        "id = %u, version %d unchanged", region_id, version);
+    return;
+  }
+
   if (!region) {                /* Create a new region */
-    region = g_slice_new0 (DVBSubRegion);
+    region = dvb_arena_new0 (&priv->arena, DVBSubRegion);
     region->id = region_id;
     region->next = priv->region_list;
     priv->region_list = region;
+    priv->regions[region_id] = region;
   }
 
+  region->version = version;
+  priv->display_set_changed = TRUE;
   fill = ((*buf++) >> 3) & 1;
 
   region->width = GST_READ_UINT16_BE (buf);
@@ -521,17 +828,25 @@ _dvb_sub_parse_region_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
   region->height = GST_READ_UINT16_BE (buf);
   buf += 2;
 
-  if (region->width * region->height != region->buf_size) {     /* FIXME: Read closer from spec what happens when dimensions change */
-    if (region->pbuf)
-      g_free (region->pbuf);
+  stride = region->width;
+  if (priv->allocator.rowstride_align > 1)
+    stride = (stride + priv->allocator.rowstride_align - 1) &
+        ~(priv->allocator.rowstride_align - 1);
+
+  if (stride != region->stride || stride * region->height != region->buf_size) {        /* FIXME: Read closer from spec what happens when dimensions change */
+    /* A buffer of the same size class is handed right back by the pool */
+    dvb_buffer_pool_release (&priv->buffer_pool, region->pbuf);
 
-    region->buf_size = region->width * region->height;
+    region->stride = stride;
+    region->buf_size = stride * region->height;
 
-    region->pbuf = g_malloc (region->buf_size); /* TODO: We can probably use GSlice here if careful about freeing while buf_size still records the correct size */
+    region->pbuf = _dvb_sub_alloc_region_buffer (dvb_sub, region->buf_size);
 
     fill = 1;                   /* FIXME: Validate from spec that fill is forced on (in the following codes context) when dimensions change */
   }
 
+  old_clut = region->clut;
+  old_depth = region->depth;
   region->depth = 1 << (((*buf++) >> 2) & 7);
   if (region->depth < 2 || region->depth > 8) {
     g_warning ("region depth %d is invalid\n", region->depth);
@@ -540,6 +855,10 @@ _dvb_sub_parse_region_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
 
   region->clut = *buf++;
 
+  /* Another palette shows all pixels in other colours */
+  if (region->clut != old_clut || region->depth != old_depth)
+    _dvb_sub_box_add (&region->dirty, 0, 0, region->width, region->height);
+
   if (region->depth == 8)
     region->bgcolor = *buf++;
   else {
@@ -556,7 +875,9 @@ _dvb_sub_parse_region_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
       region_id, region->width, region->height, region->depth);
 
   if (fill) {
+    _dvb_sub_region_make_writable (dvb_sub, region, FALSE);
     memset (region->pbuf, region->bgcolor, region->buf_size);
+    _dvb_sub_box_add (&region->dirty, 0, 0, region->width, region->height);
     dvb_log (DVB_LOG_REGION, G_LOG_LEVEL_DEBUG,
         "Filling region (%u) with bgcolor = %u", region->id, region->bgcolor);
   }
@@ -570,17 +891,17 @@ _dvb_sub_parse_region_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
     object = get_object (dvb_sub, object_id);
 
     if (!object) {
-      object = g_slice_new0 (DVBSubObject);
+      object = dvb_arena_new0 (&priv->arena, DVBSubObject);
 
       object->id = object_id;
+      object->version = -1;
 
-      object->next = priv->object_list;
-      priv->object_list = object;
+      add_object (dvb_sub, object);
     }
 
     object->type = (*buf) >> 6;
 
-    object_display = g_slice_new0 (DVBSubObjectDisplay);
+    object_display = dvb_arena_new0 (&priv->arena, DVBSubObjectDisplay);
 
     object_display->object_id = object_id;
     object_display->region_id = region_id;
@@ -621,22 +942,34 @@ _dvb_sub_parse_clut_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
   const guint8 *buf_end = buf + buf_size;
   guint8 clut_id;
   DVBSubCLUT *clut;
+  DVBSubRegion *region;
+  int version;
   int entry_id, depth, full_range;
   int y, cr, cb, alpha;
   int r, g, b, r_add, g_add, b_add;
+  guint32 yuv;
 
 #ifdef DEBUG_PACKET_CONTENTS
   g_print ("DVB clut packet:\n");
   gst_util_dump_mem (buf, buf_size);
 #endif
 
+  if (buf_size < 2)
+    return;
+
   clut_id = *buf++;
-  buf += 1;
+  version = (*buf++) >> 4;
 
   clut = get_clut (dvb_sub, clut_id);
 
+  if (clut && clut->version == version) {
+    dvb_log (DVB_LOG_CLUT, G_LOG_LEVEL_DEBUG,
+        "CLUT %u version %d unchanged", clut_id, version);
+    return;
+  }
+
   if (!clut) {
-    clut = g_slice_new (DVBSubCLUT);    /* FIXME-MEMORY-LEAK: This seems to leak per valgrind */
+    clut = dvb_arena_new0 (&priv->arena, DVBSubCLUT);
 
     memcpy (clut, &default_clut, sizeof (DVBSubCLUT));
 
@@ -644,6 +977,18 @@ _dvb_sub_parse_clut_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
 
     clut->next = priv->clut_list;
     priv->clut_list = clut;
+    priv->cluts[clut_id] = clut;
+  }
+
+  clut->version = version;
+  release_palettes (clut->palettes);
+  release_palettes (clut->yuv_palettes);
+  priv->display_set_changed = TRUE;
+
+  /* The colours of all regions using the CLUT change without any drawing */
+  for (region = priv->region_list; region; region = region->next) {
+    if (region->clut == clut_id)
+      _dvb_sub_box_add (&region->dirty, 0, 0, region->width, region->height);
   }
 
   while (buf + 4 < buf_end) {
@@ -675,18 +1020,28 @@ _dvb_sub_parse_clut_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
     if (y == 0)
       alpha = 0xff;
 
+    /* Kept before the conversion macros clobber y, cb and cr */
+    yuv = AYUV ((guint32) y, (guint32) cb, (guint32) cr, 255U - alpha);
+
     YUV_TO_RGB1_CCIR (cb, cr);
     YUV_TO_RGB2_CCIR (r, g, b, y);
 
     dvb_log (DVB_LOG_CLUT, G_LOG_LEVEL_DEBUG,
         "CLUT DEFINITION: clut %d := (%d,%d,%d,%d)", entry_id, r, g, b, alpha);
 
-    if (depth & 0x80)
+    /* Entries beyond the size of a table are ignored */
+    if ((depth & 0x80) && entry_id < 4) {
       clut->clut4[entry_id] = RGBA (r, g, b, 255 - alpha);
-    if (depth & 0x40)
+      clut->yuv4[entry_id] = yuv;
+    }
+    if ((depth & 0x40) && entry_id < 16) {
       clut->clut16[entry_id] = RGBA (r, g, b, 255 - alpha);
-    if (depth & 0x20)
+      clut->yuv16[entry_id] = yuv;
+    }
+    if (depth & 0x20) {
       clut->clut256[entry_id] = RGBA (r, g, b, 255 - alpha);
+      clut->yuv256[entry_id] = yuv;
+    }
   }
 }
 
@@ -696,8 +1051,7 @@ static int
 _dvb_sub_read_2bit_string (guint8 * destbuf, gint dbuf_len,
     const guint8 ** srcbuf, gint buf_size, guint8 non_mod, guint8 * map_table)
 {
-  GstBitReader gb = GST_BIT_READER_INIT (*srcbuf, buf_size);
-  /* FIXME: Handle FALSE returns from gst_bit_reader_get_* calls? */
+  DvbBitReader gb;
 
   gboolean stop_parsing = FALSE;
   guint32 bits;
@@ -713,25 +1067,26 @@ _dvb_sub_read_2bit_string (guint8 * destbuf, gint dbuf_len,
   dvb_log (DVB_LOG_PIXEL, G_LOG_LEVEL_DEBUG,
       "(n=2): Inside %s with dbuf_len = %d", __PRETTY_FUNCTION__, dbuf_len);
 
-  while (!stop_parsing && (gst_bit_reader_get_remaining (&gb) > 0)) {
+  dvb_bit_reader_init (&gb, *srcbuf, buf_size);
+  while (!stop_parsing && (dvb_bit_reader_get_remaining (&gb) > 0)) {
     guint run_length = 0, clut_index = 0;
-    gst_bit_reader_get_bits_uint32 (&gb, &bits, 2);
+    bits = dvb_bit_reader_get_bits (&gb, 2);
 
     if (bits) {                 /* 2-bit_pixel-code */
       run_length = 1;
       clut_index = bits;
     } else {                    /* 2-bit_zero */
-      gst_bit_reader_get_bits_uint32 (&gb, &bits, 1);
+      bits = dvb_bit_reader_get_bits (&gb, 1);
       if (bits == 1) {          /* switch_1 == '1' */
-        gst_bit_reader_get_bits_uint32 (&gb, &run_length, 3);
+        run_length = dvb_bit_reader_get_bits (&gb, 3);
         run_length += 3;
-        gst_bit_reader_get_bits_uint32 (&gb, &clut_index, 2);
+        clut_index = dvb_bit_reader_get_bits (&gb, 2);
       } else {                  /* switch_1 == '0' */
-        gst_bit_reader_get_bits_uint32 (&gb, &bits, 1);
+        bits = dvb_bit_reader_get_bits (&gb, 1);
         if (bits == 1) {        /* switch_2 == '1' */
           run_length = 1;       /* 1x pseudo-colour '00' */
         } else {                /* switch_2 == '0' */
-          gst_bit_reader_get_bits_uint32 (&gb, &bits, 2);
+          bits = dvb_bit_reader_get_bits (&gb, 2);
           switch (bits) {       /* switch_3 */
             case 0x0:          /* end of 2-bit/pixel_code_string */
               stop_parsing = TRUE;
@@ -740,14 +1095,14 @@ _dvb_sub_read_2bit_string (guint8 * destbuf, gint dbuf_len,
               run_length = 2;
               break;
             case 0x2:          /* the following 6 bits contain run length coded pixel data */
-              gst_bit_reader_get_bits_uint32 (&gb, &run_length, 4);
+              run_length = dvb_bit_reader_get_bits (&gb, 4);
               run_length += 12;
-              gst_bit_reader_get_bits_uint32 (&gb, &clut_index, 2);
+              clut_index = dvb_bit_reader_get_bits (&gb, 2);
               break;
             case 0x3:          /* the following 10 bits contain run length coded pixel data */
-              gst_bit_reader_get_bits_uint32 (&gb, &run_length, 8);
+              run_length = dvb_bit_reader_get_bits (&gb, 8);
               run_length += 29;
-              gst_bit_reader_get_bits_uint32 (&gb, &clut_index, 2);
+              clut_index = dvb_bit_reader_get_bits (&gb, 2);
               break;
           }
         }
@@ -764,26 +1119,25 @@ _dvb_sub_read_2bit_string (guint8 * destbuf, gint dbuf_len,
     run_length = MIN (run_length, dbuf_len);
     dbuf_len -= run_length;
 
-    /* Make clut_index refer to the index into the desired bit depths
-     * CLUT definition table */
-    if (map_table)
-      clut_index = map_table[clut_index];       /* now clut_index signifies the index into map_table dest */
-
     /* Now we can simply memset run_length count of destination bytes
      * to clut_index, but only if not non_modifying */
     dvb_log (DVB_LOG_RUNLEN, G_LOG_LEVEL_DEBUG,
         "Setting %u pixels to color 0x%x in destination buffer; dbuf_len left is %d pixels",
         run_length, clut_index, dbuf_len);
-    if (!(non_mod == 1 && bits == 1))
+    if (!(non_mod == 1 && clut_index == 1)) {
+      /* Make clut_index refer to the index into the desired bit depths
+       * CLUT definition table */
+      if (map_table)
+        clut_index = map_table[clut_index];     /* now clut_index signifies the index into map_table dest */
       memset (destbuf, clut_index, run_length);
+    }
 
     destbuf += run_length;
     pixels_read += run_length;
   }
 
   // FIXME: Test skip_to_byte instead of adding 7 bits, once everything else is working good
-  //gst_bit_reader_skip_to_byte (&gb);
-  *srcbuf += (gst_bit_reader_get_pos (&gb) + 7) >> 3;
+  *srcbuf += (dvb_bit_reader_get_pos (&gb) + 7) >> 3;
 
   dvb_log (DVB_LOG_PIXEL, G_LOG_LEVEL_DEBUG,
       "Returning from 2bit_string parser with %u pixels read", pixels_read);
@@ -791,66 +1145,115 @@ _dvb_sub_read_2bit_string (guint8 * destbuf, gint dbuf_len,
   return pixels_read;
 }
 
+/* One entry of the 4-bit/pixel code lookup table, indexed by the next 12 bits
+ * of a 4-bit/pixel_code_string */
+typedef struct
+{
+  guint8 bits;                  /* code length; 0 for the long runs left to the slow path */
+  guint8 run_length;            /* pixels; 0 for end_of_string_signal */
+  guint8 clut_index;
+  guint8 literal;               /* run_length single pixel codes, colours in the peeked bits */
+} DvbSub4bitCode;
+
+static DvbSub4bitCode dvb_sub_4bit_codes[1 << 12];
+
+static void
+_dvb_sub_init_4bit_codes (void)
+{
+  DvbSub4bitCode *code;
+  guint bits, i;
+
+  for (bits = 0; bits < G_N_ELEMENTS (dvb_sub_4bit_codes); ++bits) {
+    code = &dvb_sub_4bit_codes[bits];
+
+    if (bits >> 8) {            /* 4-bit_pixel-code, maybe followed by more */
+      for (i = 1; i < 3 && ((bits >> (8 - 4 * i)) & 0xf); ++i);
+      code->bits = 4 * i;
+      code->run_length = i;
+      code->literal = TRUE;
+    } else if (!(bits & 0x80)) {        /* switch_1 == '0' */
+      code->bits = 8;
+      code->run_length = (bits >> 4) & 0x7;
+      if (code->run_length)
+        code->run_length += 2;
+    } else if (!(bits & 0x40)) {        /* switch_2 == '0' */
+      code->bits = 12;
+      code->run_length = ((bits >> 4) & 0x3) + 4;
+      code->clut_index = bits & 0xf;
+    } else {
+      switch ((bits >> 4) & 0x3) {      /* switch_3 */
+        case 0x0:              /* 1 pixel of pseudo-color 0 */
+          code->bits = 8;
+          code->run_length = 1;
+          break;
+        case 0x1:              /* 2 pixels of pseudo-color 0 */
+          code->bits = 8;
+          code->run_length = 2;
+          break;
+        default:               /* run_length_9-24 and run_length_25-280 */
+          break;
+      }
+    }
+  }
+}
+
 // FFMPEG-FIXME: The same code in ffmpeg is much more complex, it could use the same
 // FFMPEG-FIXME: refactoring as done here, explained in commit 895296c3
 static int
 _dvb_sub_read_4bit_string (guint8 * destbuf, gint dbuf_len,
     const guint8 ** srcbuf, gint buf_size, guint8 non_mod, guint8 * map_table)
 {
-  GstBitReader gb = GST_BIT_READER_INIT (*srcbuf, buf_size);
-  /* FIXME: Handle FALSE returns from gst_bit_reader_get_* calls? */
+  DvbBitReader gb;
+  const DvbSub4bitCode *code;
   gboolean stop_parsing = FALSE;
   guint32 bits;
   guint32 pixels_read = 0;
+  guint i;
 
   dvb_log (DVB_LOG_RUNLEN, G_LOG_LEVEL_DEBUG,
       "Entering 4bit_string parser at srcbuf position %p with buf_size = %d; destination buffer size is %d @ %p",
       *srcbuf, buf_size, dbuf_len, destbuf);
 
-  while (!stop_parsing && (gst_bit_reader_get_remaining (&gb) > 0)) {
+  dvb_bit_reader_init (&gb, *srcbuf, buf_size);
+  while (!stop_parsing && (dvb_bit_reader_get_remaining (&gb) > 0)) {
     guint run_length = 0, clut_index = 0;
-    gst_bit_reader_get_bits_uint32 (&gb, &bits, 4);
 
-    if (bits) {
-      run_length = 1;
-      clut_index = bits;
-    } else {
-      gst_bit_reader_get_bits_uint32 (&gb, &bits, 1);
-      if (bits == 0) {          /* switch_1 == '0' */
-        gst_bit_reader_get_bits_uint32 (&gb, &run_length, 3);
-        if (!run_length) {
-          stop_parsing = TRUE;
-        } else {
-          run_length += 2;
-        }
-      } else {                  /* switch_1 == '1' */
-        gst_bit_reader_get_bits_uint32 (&gb, &bits, 1);
-        if (bits == 0) {        /* switch_2 == '0' */
-          gst_bit_reader_get_bits_uint32 (&gb, &run_length, 2);
-          run_length += 4;
-          gst_bit_reader_get_bits_uint32 (&gb, &clut_index, 4);
-        } else {                /* switch_2 == '1' */
-          gst_bit_reader_get_bits_uint32 (&gb, &bits, 2);
-          switch (bits) {
-            case 0x0:          /* switch_3 == '00' */
-              run_length = 1;   /* 1 pixel of pseudo-color 0 */
-              break;
-            case 0x1:          /* switch_3 == '01' */
-              run_length = 2;   /* 2 pixels of pseudo-color 0 */
-              break;
-            case 0x2:          /* switch_3 == '10' */
-              gst_bit_reader_get_bits_uint32 (&gb, &run_length, 4);
-              run_length += 9;
-              gst_bit_reader_get_bits_uint32 (&gb, &clut_index, 4);
-              break;
-            case 0x3:          /* switch_3 == '11' */
-              gst_bit_reader_get_bits_uint32 (&gb, &run_length, 8);
-              run_length += 25;
-              gst_bit_reader_get_bits_uint32 (&gb, &clut_index, 4);
-              break;
-          }
-        }
+    /* All but the two longest codes are resolved with a single table lookup
+     * on the next 12 bits, which also covers up to three 4-bit_pixel-codes */
+    bits = dvb_bit_reader_peek_bits (&gb, 12);
+    code = &dvb_sub_4bit_codes[bits];
+
+    if (code->literal) {
+      dvb_bit_reader_skip_bits (&gb, code->bits);
+      run_length = MIN (code->run_length, dbuf_len);
+      for (i = 0; i < run_length; ++i) {
+        clut_index = (bits >> (8 - 4 * i)) & 0xf;
+        if (!(non_mod == 1 && clut_index == 1))
+          destbuf[i] = map_table ? map_table[clut_index] : clut_index;
+      }
+
+      dbuf_len -= run_length;
+      destbuf += run_length;
+      pixels_read += run_length;
+      continue;
+    }
+
+    if (G_LIKELY (code->bits)) {
+      dvb_bit_reader_skip_bits (&gb, code->bits);
+      run_length = code->run_length;
+      clut_index = code->clut_index;
+      if (!run_length)
+        stop_parsing = TRUE;
+    } else {                    /* switch_3 == '10' or '11' */
+      dvb_bit_reader_skip_bits (&gb, 8);
+      if (((bits >> 4) & 0x3) == 0x2) {
+        run_length = dvb_bit_reader_get_bits (&gb, 4);
+        run_length += 9;
+      } else {
+        run_length = dvb_bit_reader_get_bits (&gb, 8);
+        run_length += 25;
       }
+      clut_index = dvb_bit_reader_get_bits (&gb, 4);
     }
 
     /* If run_length is zero, continue. Only case happening is when
@@ -863,26 +1266,24 @@ _dvb_sub_read_4bit_string (guint8 * destbuf, gint dbuf_len,
     run_length = MIN (run_length, dbuf_len);
     dbuf_len -= run_length;
 
-    /* Make clut_index refer to the index into the desired bit depths
-     * CLUT definition table */
-    if (map_table)
-      clut_index = map_table[clut_index];       /* now clut_index signifies the index into map_table dest */
-
     /* Now we can simply memset run_length count of destination bytes
      * to clut_index, but only if not non_modifying */
     dvb_log (DVB_LOG_RUNLEN, G_LOG_LEVEL_DEBUG,
         "Setting %u pixels to color 0x%x in destination buffer; dbuf_len left is %d pixels",
         run_length, clut_index, dbuf_len);
-    if (!(non_mod == 1 && bits == 1))
+    if (!(non_mod == 1 && clut_index == 1)) {
+      /* Make clut_index refer to the index into the desired bit depths
+       * CLUT definition table */
+      if (map_table)
+        clut_index = map_table[clut_index];     /* now clut_index signifies the index into map_table dest */
       memset (destbuf, clut_index, run_length);
+    }
 
     destbuf += run_length;
     pixels_read += run_length;
   }
 
-  // FIXME: Test skip_to_byte instead of adding 7 bits, once everything else is working good
-  //gst_bit_reader_skip_to_byte (&gb);
-  *srcbuf += (gst_bit_reader_get_pos (&gb) + 7) >> 3;
+  *srcbuf += (dvb_bit_reader_get_pos (&gb) + 7) >> 3;
 
   dvb_log (DVB_LOG_PIXEL, G_LOG_LEVEL_DEBUG,
       "Returning from 4bit_string parser with %u pixels read", pixels_read);
@@ -894,8 +1295,7 @@ static int
 _dvb_sub_read_8bit_string (guint8 * destbuf, gint dbuf_len,
     const guint8 ** srcbuf, gint buf_size, guint8 non_mod, guint8 * map_table)
 {
-  GstBitReader gb = GST_BIT_READER_INIT (*srcbuf, buf_size);
-  /* FIXME: Handle FALSE returns from gst_bit_reader_get_* calls? */
+  DvbBitReader gb;
 
   gboolean stop_parsing = FALSE;
   guint32 bits;
@@ -913,30 +1313,31 @@ _dvb_sub_read_8bit_string (guint8 * destbuf, gint dbuf_len,
 
   /* FFMPEG-FIXME: ffmpeg uses a manual byte walking algorithm, which might be more performant,
    * FFMPEG-FIXME: but it does almost absolutely no buffer length checking, so could walk over
-   * FFMPEG-FIXME: memory boundaries. While we don't check gst_bit_reader_get_bits_uint32
-   * FFMPEG-FIXME: return values either and therefore might get some pixels corrupted, we at
-   * FFMPEG-FIXME: lest have no chance of reading memory we don't own and visual corruption
+   * FFMPEG-FIXME: memory boundaries. Reads past the end return zero bits here, which
+   * FFMPEG-FIXME: might get some pixels corrupted, but we at
+   * FFMPEG-FIXME: least have no chance of reading memory we don't own and visual corruption
    * FFMPEG-FIXME: is guaranteed anyway when not all bytes are present */
   /* Rephrased - it's better to work with bytes with default value '0' instead of reading from memory we don't own. */
-  while (!stop_parsing && (gst_bit_reader_get_remaining (&gb) > 0)) {
+  dvb_bit_reader_init (&gb, *srcbuf, buf_size);
+  while (!stop_parsing && (dvb_bit_reader_get_remaining (&gb) > 0)) {
     guint run_length = 0, clut_index = 0;
-    gst_bit_reader_get_bits_uint32 (&gb, &bits, 8);
+    bits = dvb_bit_reader_get_bits (&gb, 8);
 
     if (bits) {                 /* 8-bit_pixel-code */
       run_length = 1;
       clut_index = bits;
     } else {                    /* 8-bit_zero */
-      gst_bit_reader_get_bits_uint32 (&gb, &bits, 1);
+      bits = dvb_bit_reader_get_bits (&gb, 1);
       if (bits == 0) {          /* switch_1 == '0' */
         /* run_length_1-127 for pseudo-colour _entry) '0x00' */
-        gst_bit_reader_get_bits_uint32 (&gb, &run_length, 7);
+        run_length = dvb_bit_reader_get_bits (&gb, 7);
         if (run_length == 0) {  /* end_of_string_signal */
           stop_parsing = TRUE;
         }
       } else {                  /* switch_1 == '1' */
         /* run_length_3-127 */
-        gst_bit_reader_get_bits_uint32 (&gb, &run_length, 7);
-        gst_bit_reader_get_bits_uint32 (&gb, &clut_index, 8);
+        run_length = dvb_bit_reader_get_bits (&gb, 7);
+        clut_index = dvb_bit_reader_get_bits (&gb, 8);
 #ifdef DEBUG
         /* Emit a debugging message about stream not following specification */
         if (run_length < 3) {
@@ -958,39 +1359,44 @@ _dvb_sub_read_8bit_string (guint8 * destbuf, gint dbuf_len,
     run_length = MIN (run_length, dbuf_len);
     dbuf_len -= run_length;
 
-    /* Make clut_index refer to the index into the desired bit depths
-     * CLUT definition table */
-    if (map_table)
-      clut_index = map_table[clut_index];       /* now clut_index signifies the index into map_table dest */
-
     /* Now we can simply memset run_length count of destination bytes
      * to clut_index, but only if not non_modifying */
     dvb_log (DVB_LOG_RUNLEN, G_LOG_LEVEL_DEBUG,
         "Setting %u pixels to color 0x%x in destination buffer; dbuf_len left is %d pixels",
         run_length, clut_index, dbuf_len);
-    if (!(non_mod == 1 && bits == 1))
+    if (!(non_mod == 1 && clut_index == 1)) {
+      /* Make clut_index refer to the index into the desired bit depths
+       * CLUT definition table */
+      if (map_table)
+        clut_index = map_table[clut_index];     /* now clut_index signifies the index into map_table dest */
       memset (destbuf, clut_index, run_length);
+    }
 
     destbuf += run_length;
     pixels_read += run_length;
   }
 
+  *srcbuf += (dvb_bit_reader_get_pos (&gb) + 7) >> 3;
+
   dvb_log (DVB_LOG_PIXEL, G_LOG_LEVEL_DEBUG,
       "Returning from 8bit_string parser with %u pixels read", pixels_read);
   // FIXME: Shouldn't need this variable if tracking things in the loop better
   return pixels_read;
 }
 
+/* Decodes the pixel-data sub-blocks of one field into the depth bits per pixel
+ * bitmap pbuf of width x height pixels with stride bytes per line, starting
+ * at x_start, y_start and
+ * advancing two lines per end of object line. If line_lens is given, the
+ * amount of pixels written from x_start on is recorded for every line. If
+ * dirty is given, the area written to is added to it */
 static void
-_dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
-    DVBSubObjectDisplay * display, const guint8 * buf, gint buf_size,
-    DvbSubPixelDataSubBlockFieldType top_bottom, guint8 non_mod)
+_dvb_sub_decode_pixel_data_block (const guint8 * buf, gint buf_size,
+    guint8 * pbuf, gint width, gint height, gint stride, guint8 depth,
+    gint x_start, gint y_start, guint8 non_mod, gint * line_lens,
+    DvbSubBox * dirty)
 {
-  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
-
-  DVBSubRegion *region = get_region (dvb_sub, display->region_id);
   const guint8 *buf_end = buf + buf_size;
-  guint8 *pbuf;
   int x_pos, y_pos;
   int i;
   gboolean dest_buf_filled = FALSE;
@@ -1002,39 +1408,20 @@ _dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
   };
   guint8 *map_table;
 
-  dvb_log (DVB_LOG_PIXEL, G_LOG_LEVEL_DEBUG,
-      "(parse_block): DVB pixel block size %d, %s field:",
-      buf_size, top_bottom ? "bottom" : "top");
-
-#ifdef DEBUG_PACKET_CONTENTS
-  gst_util_dump_mem (buf, buf_size);
-#endif
-
-  if (region == NULL) {
-    g_print ("Region is NULL, returning\n");
-    return;
-  }
-
-  pbuf = region->pbuf;
-
-  x_pos = display->x_pos;
-  y_pos = display->y_pos;
-
-  if ((y_pos & 1) != top_bottom)
-    y_pos++;
+  x_pos = x_start;
+  y_pos = y_start;
 
   while (buf < buf_end) {
     dvb_log (DVB_LOG_PIXEL, G_LOG_LEVEL_DEBUG,
         "Iteration start, %u bytes missing from end; buf = %p, buf_end = %p;  "
-        "Region is number %u, with a dimension of %dx%d; We are at position %dx%d",
-        buf_end - buf, buf, buf_end,
-        region->id, region->width, region->height, x_pos, y_pos);
+        "Bitmap dimension is %dx%d; We are at position %dx%d",
+        buf_end - buf, buf, buf_end, width, height, x_pos, y_pos);
     // FFMPEG-FIXME: ffmpeg doesn't check for equality and so can overflow destination buffer later on with bad input data
     // FFMPEG-FIXME: However that makes it warn on end_of_object_line and map tables as well, so we add the dest_buf_filled tracking
     // FIXME: Removed x_pos checking here, because we don't want to turn dest_buf_filled to TRUE permanently in that case
-    // FIXME: We assume that region->width - x_pos as dbuf_len to read_nbit_string will take care of that case nicely;
+    // FIXME: We assume that width - x_pos as dbuf_len to read_nbit_string will take care of that case nicely;
     // FIXME: That is, that read_nbit_string never scribbles anything if dbuf_len passed to it is zero due to this.
-    if (y_pos >= region->height) {
+    if (y_pos >= height) {
       dest_buf_filled = TRUE;
     }
 
@@ -1047,9 +1434,9 @@ _dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
           return;
         }
 
-        if (region->depth == 8)
+        if (depth == 8)
           map_table = map2to8;
-        else if (region->depth == 4)
+        else if (depth == 4)
           map_table = map2to4;
         else
           map_table = NULL;
@@ -1057,8 +1444,13 @@ _dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
         // FFMPEG-FIXME: ffmpeg code passes buf_size instead of buf_end - buf, and could
         // FFMPEG-FIXME: therefore potentially walk over the memory area we own
         x_pos +=
-            _dvb_sub_read_2bit_string (pbuf + (y_pos * region->width) + x_pos,
-            region->width - x_pos, &buf, buf_end - buf, non_mod, map_table);
+            _dvb_sub_read_2bit_string (pbuf + (y_pos * stride) + x_pos,
+            MAX (width - x_pos, 0), &buf, buf_end - buf, non_mod, map_table);
+        if (line_lens)
+          line_lens[y_pos] = x_pos - x_start;
+        if (dirty)
+          _dvb_sub_box_add (dirty, x_start, y_pos, MIN (x_pos, width),
+              y_pos + 1);
         break;
       case 0x11:
         if (dest_buf_filled) {
@@ -1068,12 +1460,12 @@ _dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
           return;               // FIXME: Perhaps tell read_nbit_string that dbuf_len is zero and let it walk the bytes regardless? (Same FIXME for 2bit and 8bit)
         }
 
-        if (region->depth < 4) {
-          g_warning ("4-bit pixel string in %d-bit region!\n", region->depth);
+        if (depth < 4) {
+          g_warning ("4-bit pixel string in %d-bit region!\n", depth);
           return;
         }
 
-        if (region->depth == 8)
+        if (depth == 8)
           map_table = map4to8;
         else
           map_table = NULL;
@@ -1084,10 +1476,15 @@ _dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
         // FFMPEG-FIXME: ffmpeg code passes buf_size instead of buf_end - buf, and could
         // FFMPEG-FIXME: therefore potentially walk over the memory area we own
         x_pos +=
-            _dvb_sub_read_4bit_string (pbuf + (y_pos * region->width) + x_pos,
-            region->width - x_pos, &buf, buf_end - buf, non_mod, map_table);
+            _dvb_sub_read_4bit_string (pbuf + (y_pos * stride) + x_pos,
+            MAX (width - x_pos, 0), &buf, buf_end - buf, non_mod, map_table);
         dvb_log (DVB_LOG_PIXEL, G_LOG_LEVEL_DEBUG,
             "READ_nBIT_STRING (4) finished: buf pointer now %p", buf);
+        if (line_lens)
+          line_lens[y_pos] = x_pos - x_start;
+        if (dirty)
+          _dvb_sub_box_add (dirty, x_start, y_pos, MIN (x_pos, width),
+              y_pos + 1);
         break;
       case 0x12:
         if (dest_buf_filled) {
@@ -1097,15 +1494,20 @@ _dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
           return;
         }
 
-        if (region->depth < 8) {
-          g_warning ("8-bit pixel string in %d-bit region!\n", region->depth);
+        if (depth < 8) {
+          g_warning ("8-bit pixel string in %d-bit region!\n", depth);
           return;
         }
         // FFMPEG-FIXME: ffmpeg code passes buf_size instead of buf_end - buf, and could
         // FFMPEG-FIXME: therefore potentially walk over the memory area we own
         x_pos +=
-            _dvb_sub_read_8bit_string (pbuf + (y_pos * region->width) + x_pos,
-            region->width - x_pos, &buf, buf_end - buf, non_mod, NULL);
+            _dvb_sub_read_8bit_string (pbuf + (y_pos * stride) + x_pos,
+            MAX (width - x_pos, 0), &buf, buf_end - buf, non_mod, NULL);
+        if (line_lens)
+          line_lens[y_pos] = x_pos - x_start;
+        if (dirty)
+          _dvb_sub_box_add (dirty, x_start, y_pos, MIN (x_pos, width),
+              y_pos + 1);
         break;
 
       case 0x20:
@@ -1134,7 +1536,7 @@ _dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
       case 0xf0:
         dvb_log (DVB_LOG_PIXEL, G_LOG_LEVEL_DEBUG,
             "(parse_block): end of object line code encountered");
-        x_pos = display->x_pos;
+        x_pos = x_start;
         y_pos += 2;
         break;
       default:
@@ -1145,64 +1547,304 @@ _dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
 }
 
 static void
-_dvb_sub_parse_object_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
-    gint buf_size)
+_dvb_sub_parse_pixel_data_block (DvbSub * dvb_sub,
+    DVBSubObjectDisplay * display, const guint8 * buf, gint buf_size,
+    DvbSubPixelDataSubBlockFieldType top_bottom, guint8 non_mod)
 {
-  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
-
-  const guint8 *buf_end = buf + buf_size;
-  guint object_id;
-  DVBSubObject *object;
-
-  guint8 coding_method, non_modifying_color;
-
-  object_id = GST_READ_UINT16_BE (buf);
-  buf += 2;
+  DVBSubRegion *region = get_region (dvb_sub, display->region_id);
+  int y_pos;
 
-  object = get_object (dvb_sub, object_id);
+  dvb_log (DVB_LOG_PIXEL, G_LOG_LEVEL_DEBUG,
+      "(parse_block): DVB pixel block size %d, %s field:",
+      buf_size, top_bottom ? "bottom" : "top");
 
-  dvb_log (DVB_LOG_OBJECT, G_LOG_LEVEL_DEBUG,
-      "parse_object_segment: A new object segment has occurred for object_id = %u",
-      object_id);
+#ifdef DEBUG_PACKET_CONTENTS
+  gst_util_dump_mem (buf, buf_size);
+#endif
 
-  if (!object) {
-    g_warning
-        ("Nothing known about object with ID %u yet inside parse_object_segment, bailing out",
-        object_id);
+  if (region == NULL) {
+    g_print ("Region is NULL, returning\n");
     return;
   }
 
-  coding_method = ((*buf) >> 2) & 3;
-  non_modifying_color = ((*buf++) >> 1) & 1;
+  y_pos = display->y_pos;
 
-  if (coding_method == 0) {
-    const guint8 *block;
-    DVBSubObjectDisplay *display;
-    guint16 top_field_len, bottom_field_len;
+  if ((y_pos & 1) != top_bottom)
+    y_pos++;
 
-    top_field_len = GST_READ_UINT16_BE (buf);
-    buf += 2;
-    bottom_field_len = GST_READ_UINT16_BE (buf);
-    buf += 2;
+  _dvb_sub_region_make_writable (dvb_sub, region, TRUE);
+  _dvb_sub_decode_pixel_data_block (buf, buf_size, region->pbuf,
+      region->width, region->height, region->stride, region->depth,
+      display->x_pos, y_pos, non_mod, NULL, &region->dirty);
+}
 
-    if (buf + top_field_len + bottom_field_len > buf_end) {
-      g_warning ("%s: Field data size too large\n", __PRETTY_FUNCTION__);
-      return;
+/* Looks up a decoded pixmap for the given coded object data, covering at
+ * least width x height pixels. Hits are moved to the front of the cache */
+static DVBSubObjectCacheEntry *
+_dvb_sub_object_cache_lookup (DvbSub * dvb_sub, guint16 object_id,
+    guint8 depth, guint32 hash, const guint8 * buf, gint data_len,
+    guint16 top_field_len, gint width, gint height)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  DVBSubObjectCacheEntry *entry, **prev;
+
+  for (prev = &priv->object_cache; *prev; prev = &(*prev)->next) {
+    entry = *prev;
+    if (entry->object_id == object_id && entry->hash == hash
+        && entry->depth == depth && entry->data_len == data_len
+        && entry->top_field_len == top_field_len
+        && entry->width >= width && entry->height >= height
+        && memcmp (entry->data, buf, data_len) == 0) {
+      *prev = entry->next;
+      entry->next = priv->object_cache;
+      priv->object_cache = entry;
+      return entry;
     }
+  }
 
-    /* FIXME: Potential optimization opportunity here - parse the object pixmap only once, and copy it to all the
-     * FIXME: regions that need it. One object being in multiple regions is a rare occurrence in real life, however */
-    for (display = object->display_list; display;
-        display = display->object_list_next) {
-      block = buf;
+  return NULL;
+}
 
-      dvb_log (DVB_LOG_OBJECT, G_LOG_LEVEL_DEBUG,
-          "Parsing top and bottom part of object id %d; top_field_len = %u, bottom_field_len = %u",
-          display->object_id, top_field_len, bottom_field_len);
-      _dvb_sub_parse_pixel_data_block (dvb_sub, display, block, top_field_len,
-          TOP_FIELD, non_modifying_color);
+/* Returns a cache entry at the front of the cache to decode new data into,
+ * reusing the least recently used one if the cache is full */
+static DVBSubObjectCacheEntry *
+_dvb_sub_object_cache_insert (DvbSub * dvb_sub)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  DVBSubObjectCacheEntry *entry, **prev;
 
-      if (bottom_field_len > 0)
+  if (priv->object_cache_len < DVB_SUB_OBJECT_CACHE_SIZE) {
+    entry = g_slice_new0 (DVBSubObjectCacheEntry);
+    priv->object_cache_len++;
+  } else {
+    prev = &priv->object_cache;
+    while ((*prev)->next)
+      prev = &(*prev)->next;
+    entry = *prev;
+    *prev = NULL;
+  }
+
+  entry->next = priv->object_cache;
+  priv->object_cache = entry;
+
+  return entry;
+}
+
+/* FNV-1a hash of the coded object data */
+static guint32
+_dvb_sub_object_data_hash (const guint8 * buf, gint len)
+{
+  guint32 hash = 2166136261U;
+
+  while (len-- > 0) {
+    hash ^= *buf++;
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+/* Decodes the pixmap of an object once into a cached bitmap and copies it
+ * to every region displaying it. The bitmap holds the lines of both fields
+ * interleaved as for an object on an even line; they swap places when copied
+ * to an odd one. Objects repeated unchanged, as happens at every acquisition
+ * point, are copied from the cache without decoding them again.
+ * Returns FALSE if the regions need separate decoding */
+static gboolean
+_dvb_sub_decode_object_once (DvbSub * dvb_sub, DVBSubObject * object,
+    const guint8 * buf, guint16 top_field_len, guint16 bottom_field_len,
+    guint8 non_mod)
+{
+  DVBSubObjectDisplay *display;
+  DVBSubObjectCacheEntry *entry;
+  DVBSubRegion *region;
+  gint width = 0, height = 0, depth = -1;
+  gint y, dest_y, len, data_len;
+  guint32 hash;
+
+  /* Pixels of the non-modifying colour keep what each region has there */
+  if (non_mod)
+    return FALSE;
+
+  for (display = object->display_list; display;
+      display = display->object_list_next) {
+    region = get_region (dvb_sub, display->region_id);
+    if (!region)
+      continue;
+
+    /* The map tables used for decoding depend on the region depth */
+    if (depth >= 0 && region->depth != depth)
+      return FALSE;
+    depth = region->depth;
+
+    width = MAX (width, region->width - display->x_pos);
+    /* On an odd line the last region line belongs to the bottom field */
+    height = MAX (height, region->height - display->y_pos +
+        (display->y_pos & 1));
+  }
+
+  if (width <= 0 || height <= 0)
+    return TRUE;
+
+  data_len = top_field_len + bottom_field_len;
+  hash = _dvb_sub_object_data_hash (buf, data_len);
+
+  entry = _dvb_sub_object_cache_lookup (dvb_sub, object->id, depth, hash,
+      buf, data_len, top_field_len, width, height);
+
+  if (entry) {
+    dvb_log (DVB_LOG_OBJECT, G_LOG_LEVEL_DEBUG,
+        "Object id %d data unchanged, using cached %dx%d bitmap",
+        object->id, entry->width, entry->height);
+  } else {
+    entry = _dvb_sub_object_cache_insert (dvb_sub);
+
+    entry->object_id = object->id;
+    entry->depth = depth;
+    entry->hash = hash;
+    entry->top_field_len = top_field_len;
+    if (data_len > entry->data_size) {
+      entry->data_size = data_len;
+      g_free (entry->data);
+      entry->data = g_malloc (data_len);
+    }
+    memcpy (entry->data, buf, data_len);
+    entry->data_len = data_len;
+
+    if (width * height > entry->pbuf_size) {
+      entry->pbuf_size = width * height;
+      g_free (entry->pbuf);
+      entry->pbuf = g_malloc (entry->pbuf_size);
+    }
+    if (height > entry->line_lens_size) {
+      entry->line_lens_size = height;
+      g_free (entry->line_lens);
+      entry->line_lens = g_new (gint, height);
+    }
+    memset (entry->line_lens, 0, height * sizeof (gint));
+    entry->width = width;
+    entry->height = height;
+
+    dvb_log (DVB_LOG_OBJECT, G_LOG_LEVEL_DEBUG,
+        "Decoding object id %d once into a %dx%d bitmap; top_field_len = %u, bottom_field_len = %u",
+        object->id, width, height, top_field_len, bottom_field_len);
+
+    _dvb_sub_decode_pixel_data_block (buf, top_field_len, entry->pbuf,
+        width, height, width, depth, 0, TOP_FIELD, non_mod, entry->line_lens,
+        NULL);
+
+    if (bottom_field_len > 0) {
+      _dvb_sub_decode_pixel_data_block (buf + top_field_len, bottom_field_len,
+          entry->pbuf, width, height, width, depth, 0, BOTTOM_FIELD, non_mod,
+          entry->line_lens, NULL);
+    } else {
+      /* No bottom field data - the top field lines are repeated */
+      for (y = 1; y < height; y += 2) {
+        memcpy (entry->pbuf + y * width, entry->pbuf + (y - 1) * width,
+            entry->line_lens[y - 1]);
+        entry->line_lens[y] = entry->line_lens[y - 1];
+      }
+    }
+  }
+
+  for (display = object->display_list; display;
+      display = display->object_list_next) {
+    region = get_region (dvb_sub, display->region_id);
+    if (!region)
+      continue;
+
+    _dvb_sub_region_make_writable (dvb_sub, region, TRUE);
+
+    for (y = 0; y < height; ++y) {
+      /* The fields swap places on an object starting on an odd line */
+      dest_y = display->y_pos + y;
+      if (display->y_pos & 1)
+        dest_y += (y & 1) ? -1 : 1;
+      if (dest_y >= region->height)
+        continue;
+
+      len = MIN (entry->line_lens[y], region->width - display->x_pos);
+      if (len > 0) {
+        memcpy (region->pbuf + dest_y * region->stride + display->x_pos,
+            entry->pbuf + y * entry->width, len);
+        _dvb_sub_box_add (&region->dirty, display->x_pos, dest_y,
+            display->x_pos + len, dest_y + 1);
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+_dvb_sub_parse_object_segment (DvbSub * dvb_sub, guint16 page_id, guint8 * buf,
+    gint buf_size)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+
+  const guint8 *buf_end = buf + buf_size;
+  guint object_id;
+  DVBSubObject *object;
+
+  guint8 coding_method, non_modifying_color;
+  gint version;
+
+  object_id = GST_READ_UINT16_BE (buf);
+  buf += 2;
+
+  object = get_object (dvb_sub, object_id);
+
+  dvb_log (DVB_LOG_OBJECT, G_LOG_LEVEL_DEBUG,
+      "parse_object_segment: A new object segment has occurred for object_id = %u",
+      object_id);
+
+  if (!object) {
+    g_warning
+        ("Nothing known about object with ID %u yet inside parse_object_segment, bailing out",
+        object_id);
+    return;
+  }
+
+  /* Repeats of the same object version only redraw the same pixels */
+  version = (*buf) >> 4;
+  if (object->version != version) {
+    object->version = version;
+    priv->display_set_changed = TRUE;
+  }
+
+  coding_method = ((*buf) >> 2) & 3;
+  non_modifying_color = ((*buf++) >> 1) & 1;
+
+  if (coding_method == 0) {
+    const guint8 *block;
+    DVBSubObjectDisplay *display;
+    guint16 top_field_len, bottom_field_len;
+
+    top_field_len = GST_READ_UINT16_BE (buf);
+    buf += 2;
+    bottom_field_len = GST_READ_UINT16_BE (buf);
+    buf += 2;
+
+    if (buf + top_field_len + bottom_field_len > buf_end) {
+      g_warning ("%s: Field data size too large\n", __PRETTY_FUNCTION__);
+      return;
+    }
+
+    if (_dvb_sub_decode_object_once (dvb_sub, object, buf, top_field_len,
+            bottom_field_len, non_modifying_color))
+      return;
+
+    for (display = object->display_list; display;
+        display = display->object_list_next) {
+      block = buf;
+
+      dvb_log (DVB_LOG_OBJECT, G_LOG_LEVEL_DEBUG,
+          "Parsing top and bottom part of object id %d; top_field_len = %u, bottom_field_len = %u",
+          display->object_id, top_field_len, bottom_field_len);
+      _dvb_sub_parse_pixel_data_block (dvb_sub, display, block, top_field_len,
+          TOP_FIELD, non_modifying_color);
+
+      if (bottom_field_len > 0)
         block = buf + top_field_len;
       else
         bottom_field_len = top_field_len;
@@ -1351,8 +1993,8 @@ save_display_set (DvbSub * dvb_sub)
       for (y = 0; y < region->height; y++) {
         for (x = 0; x < region->width; x++) {
           pbuf[((y + y_off) * width) + x_off + x] =
-              clut_table[region->pbuf[y * region->width + x]];
-          //g_print ("pbuf@%dx%d = 0x%x\n", x_off + x, y_off + y, clut_table[region->pbuf[y * region->width + x]]);
+              clut_table[region->pbuf[y * region->stride + x]];
+          //g_print ("pbuf@%dx%d = 0x%x\n", x_off + x, y_off + y, clut_table[region->pbuf[y * region->stride + x]]);
         }
       }
 
@@ -1386,6 +2028,7 @@ _dvb_sub_parse_display_definition_segment (DvbSub * dvb_sub, guint8 * buf,
     return 0;                   /* already have this display definition version */
 
   ctx->display_def.version = dds_version;
+  ctx->display_set_changed = TRUE;
   ctx->display_def.display_width = GST_READ_UINT16_BE (buf) + 1;
   buf += 2;
   ctx->display_def.display_height = GST_READ_UINT16_BE (buf) + 1;
@@ -1409,24 +2052,204 @@ _dvb_sub_parse_display_definition_segment (DvbSub * dvb_sub, guint8 * buf,
   return 0;
 }
 
+/* Converts AYUV entries from the BT.601 matrix to BT.709, in 10-bit fixed
+ * point. Subtitles are coded in BT.601 whatever the video is */
+static void
+_dvb_sub_ayuv_to_bt709 (guint32 * entries, gint n_entries)
+{
+  gint i, y, u, v;
+
+  for (i = 0; i < n_entries; i++) {
+    y = ((entries[i] >> 16) & 0xff) - 16;
+    u = ((entries[i] >> 8) & 0xff) - 128;
+    v = (entries[i] & 0xff) - 128;
+
+    entries[i] = AYUV ((guint32) CLAMP (16 + y + ((-118 * u - 213 * v +
+                    512) >> 10), 0, 255),
+        (guint32) CLAMP (128 + ((1043 * u + 117 * v + 512) >> 10), 0, 255),
+        (guint32) CLAMP (128 + ((77 * u + 1050 * v + 512) >> 10), 0, 255),
+        entries[i] >> 24);
+  }
+}
+
+/* Returns a new reference to a snapshot of the palette of clut, or of the
+ * default CLUT if that is NULL, for regions of the given depth. With yuv,
+ * the palette is AYUV in the configured colour matrix instead of ARGB */
+static guint32 *
+_dvb_sub_get_palette (DvbSub * dvb_sub, DVBSubCLUT * clut, guint8 depth,
+    gboolean yuv)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  guint32 **palettes;
+  const guint32 *table;
+  gint i, n_entries;
+
+  if (yuv)
+    palettes = clut ? clut->yuv_palettes : priv->default_yuv_palettes;
+  else
+    palettes = clut ? clut->palettes : priv->default_palettes;
+  if (!clut)
+    clut = &default_clut;
+
+  switch (depth) {
+    case 2:
+      i = 0;
+      table = yuv ? clut->yuv4 : clut->clut4;
+      n_entries = 4;
+      break;
+    case 8:
+      i = 2;
+      table = yuv ? clut->yuv256 : clut->clut256;
+      n_entries = 256;
+      break;
+    case 4:
+    default:
+      i = 1;
+      table = yuv ? clut->yuv16 : clut->clut16;
+      n_entries = 16;
+      break;
+  }
+
+  if (!palettes[i]) {
+    palettes[i] = dvb_shared_buffer_new (n_entries * sizeof (guint32));
+    memcpy (palettes[i], table, n_entries * sizeof (guint32));
+    if (yuv && priv->color_matrix == DVB_SUBTITLE_COLOR_MATRIX_BT709)
+      _dvb_sub_ayuv_to_bt709 (palettes[i], n_entries);
+  }
+
+  return dvb_shared_buffer_ref (palettes[i]);
+}
+
+/* Finds the smallest box around the pixels of region that aren't fully
+ * transparent with palette. Returns FALSE if there are none */
+static gboolean
+_dvb_sub_find_opaque_box (DVBSubRegion * region, const guint32 * palette,
+    DvbSubBox * box)
+{
+  guint8 opaque[256] = { 0, };
+  const guint8 *row;
+  gint i, y, first, last;
+
+  if (!region->pbuf)
+    return FALSE;
+
+  for (i = 0; i < (1 << region->depth); i++)
+    opaque[i] = (palette[i] >> 24) ? 0xff : 0;
+
+  memset (box, 0, sizeof (*box));
+  row = region->pbuf;
+  for (y = 0; y < region->height; y++, row += region->stride) {
+    if (!dvb_pixels_find_opaque_span (row, region->width, opaque,
+            region->depth, &first, &last))
+      continue;
+    _dvb_sub_box_add (box, first, y, last + 1, y + 1);
+  }
+
+  return box->x1 > box->x0;
+}
+
+#define DVB_SUB_BLOCK_ALIGN(size) (((size) + 15) & ~(gsize) 15)
+
+/* Copies subs into a single memory block laid out as the DVBSubtitles, the
+ * rects array, the rects, and then the palette and pixel data of each rect,
+ * all 16 byte aligned */
+static DVBSubtitles *
+_dvb_sub_pack_subtitles (DVBSubtitles * subs)
+{
+  DVBSubtitles *packed;
+  DVBSubtitleRect *rect, *src;
+  gsize size, palette_size, data_size;
+  guint8 *ptr;
+  guint i;
+
+  size = DVB_SUB_BLOCK_ALIGN (sizeof (DVBSubtitles));
+  size += DVB_SUB_BLOCK_ALIGN (subs->num_rects * sizeof (DVBSubtitleRect *));
+  size += subs->num_rects * DVB_SUB_BLOCK_ALIGN (sizeof (DVBSubtitleRect));
+  for (i = 0; i < subs->num_rects; i++) {
+    src = subs->rects[i];
+    size += DVB_SUB_BLOCK_ALIGN ((1 << src->pict.palette_bits_count) *
+        sizeof (guint32));
+    if (src->pict.yuv_palette)
+      size += DVB_SUB_BLOCK_ALIGN ((1 << src->pict.palette_bits_count) *
+          sizeof (guint32));
+    size += DVB_SUB_BLOCK_ALIGN (src->h ? src->pict.rowstride * (src->h -
+            1) + src->w : 0);
+  }
+
+  packed = g_malloc (size);
+  *packed = *subs;
+  packed->ref_count = 1;
+  packed->block_size = size;
+
+  ptr = (guint8 *) packed + DVB_SUB_BLOCK_ALIGN (sizeof (DVBSubtitles));
+  packed->rects = (DVBSubtitleRect **) ptr;
+  ptr += DVB_SUB_BLOCK_ALIGN (subs->num_rects * sizeof (DVBSubtitleRect *));
+
+  for (i = 0; i < subs->num_rects; i++) {
+    packed->rects[i] = (DVBSubtitleRect *) ptr;
+    *packed->rects[i] = *subs->rects[i];
+    ptr += DVB_SUB_BLOCK_ALIGN (sizeof (DVBSubtitleRect));
+  }
+
+  for (i = 0; i < subs->num_rects; i++) {
+    rect = packed->rects[i];
+    src = subs->rects[i];
+
+    palette_size = (1 << src->pict.palette_bits_count) * sizeof (guint32);
+    rect->pict.palette = (guint32 *) ptr;
+    memcpy (rect->pict.palette, src->pict.palette, palette_size);
+    ptr += DVB_SUB_BLOCK_ALIGN (palette_size);
+
+    if (src->pict.yuv_palette) {
+      rect->pict.yuv_palette = (guint32 *) ptr;
+      memcpy (rect->pict.yuv_palette, src->pict.yuv_palette, palette_size);
+      ptr += DVB_SUB_BLOCK_ALIGN (palette_size);
+    }
+
+    /* Trimmed rects end before the last row of their buffer does */
+    data_size = src->h ? src->pict.rowstride * (src->h - 1) + src->w : 0;
+    rect->pict.data = data_size ? ptr : NULL;
+    rect->buffer = NULL;
+    if (data_size)
+      memcpy (rect->pict.data, src->pict.data, data_size);
+    ptr += DVB_SUB_BLOCK_ALIGN (data_size);
+  }
+
+  return packed;
+}
+
 static gint
 _dvb_sub_parse_end_of_display_set (DvbSub * dvb_sub, guint16 page_id,
     guint8 * buf, gint buf_size, guint64 pts)
 {
   DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
 
-  DVBSubtitles *sub = g_slice_new0 (DVBSubtitles);
+  DVBSubtitles *sub;
 
   DVBSubRegion *region;
   DVBSubRegionDisplay *display;
   DVBSubtitleRect *rect;
   DVBSubCLUT *clut;
-  guint32 *clut_table;
+  DvbSubBox box, dirty;
+  guint32 *palette;
+  guint32 shown_regions[8] = { 0, };
   int i;
 
   dvb_log (DVB_LOG_DISPLAY, G_LOG_LEVEL_DEBUG,
       "END OF DISPLAY SET: page_id = %u, length = %d\n", page_id, buf_size);
 
+  if (!priv->display_set_changed && priv->callbacks.unchanged) {
+    dvb_log (DVB_LOG_DISPLAY, G_LOG_LEVEL_DEBUG,
+        "Display set unchanged, extending the page time out");
+    priv->callbacks.unchanged (dvb_sub, pts, priv->page_time_out,
+        priv->user_data);
+    return 1;
+  }
+  priv->display_set_changed = FALSE;
+
+  sub = g_slice_new0 (DVBSubtitles);
+  sub->ref_count = 1;
+
   sub->rects = NULL;
 #if 0                           /* FIXME: PTS stuff not figured out yet */
   sub->start_display_time = 0;
@@ -1437,7 +2260,6 @@ _dvb_sub_parse_end_of_display_set (DvbSub * dvb_sub, guint16 page_id,
   sub->num_rects = priv->display_list_size;
 
   if (sub->num_rects > 0) {
-    // FIXME-MEMORY-LEAK: This structure is not freed up yet
     sub->rects = g_malloc0 (sizeof (*sub->rects) * sub->num_rects);     /* GSlice? */
     for (i = 0; i < sub->num_rects; i++)
       sub->rects[i] = g_malloc0 (sizeof (*sub->rects[i]));      /* GSlice? */
@@ -1455,50 +2277,82 @@ _dvb_sub_parse_end_of_display_set (DvbSub * dvb_sub, guint16 page_id,
     if (!region)
       continue;
 
-    rect->x = display->x_pos;
-    rect->y = display->y_pos;
-    rect->w = region->width;
-    rect->h = region->height;
+    clut = get_clut (dvb_sub, region->clut);
+
+    /* FIXME: Tweak this to be saved in a format most suitable for Qt and GStreamer instead.
+     * Currently kept in AVPicture for quick save_display_set testing */
+    palette = _dvb_sub_get_palette (dvb_sub, clut, region->depth, FALSE);
+
+    box.x0 = 0;
+    box.y0 = 0;
+    box.x1 = region->width;
+    box.y1 = region->height;
+    if (priv->trim_transparent
+        && !_dvb_sub_find_opaque_box (region, palette, &box)) {
+      /* Nothing to see, so it's left out like a removed region */
+      dvb_log (DVB_LOG_DISPLAY, G_LOG_LEVEL_DEBUG,
+          "Region %d is fully transparent, skipping it", region->id);
+      dvb_shared_buffer_unref (palette);
+      continue;
+    }
+
+    rect->x = display->x_pos + box.x0;
+    rect->y = display->y_pos + box.y0;
+    rect->w = box.x1 - box.x0;
+    rect->h = box.y1 - box.y0;
 #if 0                           /* FIXME: Don't think we need to save the number of colors in the palette when we are saving as RGBA? */
     rect->nb_colors = 16;
 #endif
 #if 0                           /* FIXME: Needed to be specified once we support strings of characters based subtitles */
     rect->type = SUBTITLE_BITMAP;
 #endif
-    rect->pict.rowstride = region->width;
+    rect->pict.rowstride = region->stride;
     rect->pict.palette_bits_count = region->depth;
-
-    clut = get_clut (dvb_sub, region->clut);
-
-    if (!clut)
-      clut = &default_clut;
-
-    switch (region->depth) {
-      case 2:
-        clut_table = clut->clut4;
-        break;
-      case 8:
-        clut_table = clut->clut256;
-        break;
-      case 4:
-      default:
-        clut_table = clut->clut16;
-        break;
-    }
-
-    /* FIXME: Tweak this to be saved in a format most suitable for Qt and GStreamer instead.
-     * Currently kept in AVPicture for quick save_display_set testing */
-    rect->pict.palette = g_malloc ((1 << region->depth) * sizeof (guint32));    /* FIXME: Can we use GSlice here? */
-    memcpy (rect->pict.palette, clut_table,
-        (1 << region->depth) * sizeof (guint32));
+    rect->pict.palette = palette;
+    if (priv->yuv_palette)
+      rect->pict.yuv_palette =
+          _dvb_sub_get_palette (dvb_sub, clut, region->depth, TRUE);
 #if 0
     g_print ("rect->pict.data.palette content:\n");
     gst_util_dump_mem (rect->pict.palette,
         (1 << region->depth) * sizeof (guint32));
 #endif
 
-    rect->pict.data = g_malloc (region->buf_size);      /* FIXME: Can we use GSlice here? */
-    memcpy (rect->pict.data, region->pbuf, region->buf_size);
+    /* Shared with the region until it gets drawn into again */
+    rect->buffer = dvb_shared_buffer_ref (region->pbuf);
+    if (rect->buffer)
+      rect->pict.data = rect->buffer + box.y0 * region->stride + box.x0;
+
+    /* Report what changed relative to the last display set handed out */
+    rect->region_id = region->id;
+    dirty = region->dirty;
+    if (!(priv->shown_regions[region->id / 32] & (1U << (region->id % 32)))) {
+      rect->flags = DVB_SUBTITLE_RECT_ADDED;
+      dirty = box;
+    } else {
+      if (priv->shown_x[region->id] != rect->x
+          || priv->shown_y[region->id] != rect->y)
+        rect->flags = DVB_SUBTITLE_RECT_MOVED;
+      /* A rect trimmed differently than before has to be redrawn */
+      if (priv->shown_w[region->id] != rect->w
+          || priv->shown_h[region->id] != rect->h)
+        dirty = box;
+    }
+    dirty.x0 = MAX (dirty.x0, box.x0);
+    dirty.y0 = MAX (dirty.y0, box.y0);
+    dirty.x1 = MIN (dirty.x1, box.x1);
+    dirty.y1 = MIN (dirty.y1, box.y1);
+    if (dirty.x1 > dirty.x0 && dirty.y1 > dirty.y0) {
+      rect->dirty_x = dirty.x0 - box.x0;
+      rect->dirty_y = dirty.y0 - box.y0;
+      rect->dirty_w = dirty.x1 - dirty.x0;
+      rect->dirty_h = dirty.y1 - dirty.y0;
+    }
+    shown_regions[region->id / 32] |= 1U << (region->id % 32);
+    priv->shown_x[region->id] = rect->x;
+    priv->shown_y[region->id] = rect->y;
+    priv->shown_w[region->id] = rect->w;
+    priv->shown_h[region->id] = rect->h;
 
     static unsigned counter = 0;
     ++counter;
@@ -1513,28 +2367,465 @@ _dvb_sub_parse_end_of_display_set (DvbSub * dvb_sub, guint16 page_id,
     ++i;
   }
 
+  /* Drop the rects left over for displays of undefined regions */
   sub->num_rects = i;
+  for (; i < priv->display_list_size; i++)
+    g_free (sub->rects[i]);
+
+  for (i = 0; i < 8; i++) {
+    sub->removed_regions[i] = priv->shown_regions[i] & ~shown_regions[i];
+    priv->shown_regions[i] = shown_regions[i];
+  }
+
+  for (region = priv->region_list; region; region = region->next)
+    memset (&region->dirty, 0, sizeof (region->dirty));
 
 #ifdef DEBUG_SAVE_IMAGES
   save_display_set (dvb_sub);
 #endif
 
+  if (priv->contiguous_output) {
+    DVBSubtitles *packed = _dvb_sub_pack_subtitles (sub);
+
+    dvb_subtitles_unref (sub);
+    sub = packed;
+  }
+
   if (priv->callbacks.new_data)
     priv->callbacks.new_data (dvb_sub, pts, sub, priv->page_time_out,
         priv->user_data);
 
-  /* Now free up all the temporary memory we allocated */
-  for (i = 0; i < sub->num_rects; ++i) {
-    rect = sub->rects[i];
+  dvb_subtitles_unref (sub);
+
+  return 1;                     /* FIXME: The caller of this function is probably supposed to do something with the return value */
+}
+
+/**
+ * dvb_subtitles_ref:
+ * @subs: a #DVBSubtitles
+ *
+ * Increases the reference count of @subs, to keep it beyond the new_data
+ * callback it was passed to. This is thread-safe.
+ *
+ * Return value: @subs
+ */
+DVBSubtitles *
+dvb_subtitles_ref (DVBSubtitles * subs)
+{
+  g_return_val_if_fail (subs != NULL, NULL);
+
+  g_atomic_int_inc (&subs->ref_count);
+
+  return subs;
+}
+
+/**
+ * dvb_subtitles_unref:
+ * @subs: a #DVBSubtitles
+ *
+ * Decreases the reference count of @subs, freeing it along with its
+ * rectangles when it drops to zero. The pixel data and palettes are freed
+ * once neither the decoder nor any other #DVBSubtitles uses them anymore.
+ * This is thread-safe.
+ */
+void
+dvb_subtitles_unref (DVBSubtitles * subs)
+{
+  DVBSubtitleRect *rect;
+  guint i, j;
+
+  g_return_if_fail (subs != NULL);
+
+  if (!g_atomic_int_dec_and_test (&subs->ref_count))
+    return;
 
-    g_free (rect->pict.palette);
-    g_free (rect->pict.data);
+  for (i = 0; i < subs->num_rects; ++i) {
+    for (j = 0; j < G_N_ELEMENTS (subs->rects[i]->pixels); j++)
+      g_free (subs->rects[i]->pixels[j]);
+  }
+
+  if (subs->block_size) {
+    g_free (subs);
+    return;
+  }
+
+  for (i = 0; i < subs->num_rects; ++i) {
+    rect = subs->rects[i];
+
+    dvb_shared_buffer_unref (rect->pict.palette);
+    dvb_shared_buffer_unref (rect->pict.yuv_palette);
+    dvb_shared_buffer_unref (rect->buffer);
     g_free (rect);
   }
-  g_free (sub->rects);
-  g_slice_free (DVBSubtitles, sub);
+  g_free (subs->rects);
+  g_slice_free (DVBSubtitles, subs);
+}
 
-  return 1;                     /* FIXME: The caller of this function is probably supposed to do something with the return value */
+/* Converts the ARGB palette entries to format, as 32-bit groups of bytes in
+ * memory order. AYUV entries are taken as ARGB with Y, U, V for R, G, B */
+static void
+_dvb_sub_convert_palette (const guint32 * palette, guint n_colors,
+    DVBSubtitlePixelFormat format, guint32 * converted)
+{
+  guint8 *out = (guint8 *) converted;
+  guint a, r, g, b, i;
+
+  for (i = 0; i < n_colors; i++, out += 4) {
+    a = palette[i] >> 24;
+    r = (palette[i] >> 16) & 0xff;
+    g = (palette[i] >> 8) & 0xff;
+    b = palette[i] & 0xff;
+
+    if (format >= DVB_SUBTITLE_PIXEL_FORMAT_ARGB32_PREMULTIPLIED
+        && format <= DVB_SUBTITLE_PIXEL_FORMAT_BGRA32_PREMULTIPLIED) {
+      r = (r * a + 127) / 255;
+      g = (g * a + 127) / 255;
+      b = (b * a + 127) / 255;
+    }
+
+    switch (format) {
+      case DVB_SUBTITLE_PIXEL_FORMAT_ARGB32:
+      case DVB_SUBTITLE_PIXEL_FORMAT_ARGB32_PREMULTIPLIED:
+      case DVB_SUBTITLE_PIXEL_FORMAT_AYUV:
+        out[0] = a;
+        out[1] = r;
+        out[2] = g;
+        out[3] = b;
+        break;
+      case DVB_SUBTITLE_PIXEL_FORMAT_RGBA32:
+      case DVB_SUBTITLE_PIXEL_FORMAT_RGBA32_PREMULTIPLIED:
+        out[0] = r;
+        out[1] = g;
+        out[2] = b;
+        out[3] = a;
+        break;
+      case DVB_SUBTITLE_PIXEL_FORMAT_BGRA32:
+      case DVB_SUBTITLE_PIXEL_FORMAT_BGRA32_PREMULTIPLIED:
+        out[0] = b;
+        out[1] = g;
+        out[2] = r;
+        out[3] = a;
+        break;
+    }
+  }
+}
+
+/**
+ * dvb_subtitle_rect_get_pixels:
+ * @rect: a #DVBSubtitleRect of a #DVBSubtitles
+ * @format: the pixel format wanted
+ *
+ * Gets the pixels of @rect with their colours looked up in its palette, in
+ * @format. Each row is @rect->w pixels, without padding. The conversion is
+ * done on the first call for each format and kept with @rect, so asking again
+ * is free. This may be called from any thread holding a reference to the
+ * #DVBSubtitles.
+ *
+ * %DVB_SUBTITLE_PIXEL_FORMAT_AYUV is only available if the #DvbSub was set
+ * to output YUV palettes with dvb_sub_set_yuv_palette().
+ *
+ * Return value: the pixels, owned by @rect and valid as long as its
+ * #DVBSubtitles is, or %NULL if @rect is empty or @format unavailable
+ */
+const guint32 *
+dvb_subtitle_rect_get_pixels (DVBSubtitleRect * rect,
+    DVBSubtitlePixelFormat format)
+{
+  guint32 palette[256] = { 0, };
+  const guint32 *src_palette;
+  guint32 *pixels, *dst;
+  const guint8 *src;
+  gint y;
+
+  g_return_val_if_fail (rect != NULL, NULL);
+  g_return_val_if_fail (format <= DVB_SUBTITLE_PIXEL_FORMAT_AYUV, NULL);
+
+  pixels = g_atomic_pointer_get (&rect->pixels[format]);
+  if (pixels)
+    return pixels;
+
+  src_palette = format == DVB_SUBTITLE_PIXEL_FORMAT_AYUV ?
+      rect->pict.yuv_palette : rect->pict.palette;
+  if (!src_palette || !rect->pict.data || rect->w <= 0 || rect->h <= 0)
+    return NULL;
+
+  _dvb_sub_convert_palette (src_palette,
+      1 << rect->pict.palette_bits_count, format, palette);
+
+  pixels = g_malloc ((gsize) rect->w * rect->h * sizeof (guint32));
+  src = rect->pict.data;
+  dst = pixels;
+  for (y = 0; y < rect->h; y++) {
+    dvb_pixels_expand_palette (src, dst, rect->w, palette,
+        rect->pict.palette_bits_count);
+    src += rect->pict.rowstride;
+    dst += rect->w;
+  }
+
+  /* Another thread may have been quicker converting the same */
+  if (!g_atomic_pointer_compare_and_exchange ((gpointer *) & rect->pixels[format],
+          NULL, pixels)) {
+    g_free (pixels);
+    pixels = g_atomic_pointer_get (&rect->pixels[format]);
+  }
+
+  return pixels;
+}
+
+/**
+ * dvb_subtitles_get_block:
+ * @subs: a #DVBSubtitles
+ * @size: return location for the size of the block in bytes, or %NULL
+ *
+ * Gets the memory block holding @subs, if it was output by a #DvbSub with
+ * contiguous output enabled by dvb_sub_set_contiguous_output(). The block
+ * starts with @subs itself and contains all its rects, palettes and pixel
+ * data, so it can be passed on, e.g. to another process, by copying it as
+ * a whole. Use dvb_subtitles_rebase() to fix up the pointers in a copy.
+ *
+ * Return value: the start of the block, or %NULL if @subs isn't contiguous
+ */
+gconstpointer
+dvb_subtitles_get_block (DVBSubtitles * subs, gsize * size)
+{
+  g_return_val_if_fail (subs != NULL, NULL);
+
+  if (size)
+    *size = subs->block_size;
+
+  return subs->block_size ? subs : NULL;
+}
+
+/**
+ * dvb_subtitles_rebase:
+ * @block: a copy of a block obtained with dvb_subtitles_get_block()
+ *
+ * Adjusts the pointers within a copy of a contiguous #DVBSubtitles block to
+ * the address it was copied to. The copy has a reference count of 1 and,
+ * if it was allocated with g_malloc(), can be released with
+ * dvb_subtitles_unref(); otherwise the caller frees it like it allocated it.
+ *
+ * Return value: the #DVBSubtitles at the start of @block
+ */
+DVBSubtitles *
+dvb_subtitles_rebase (gpointer block)
+{
+  DVBSubtitles *subs = block;
+  DVBSubtitleRect *rect;
+  gssize delta;
+  guint i;
+
+  g_return_val_if_fail (subs != NULL, NULL);
+  g_return_val_if_fail (subs->block_size != 0, NULL);
+
+  /* The rects array directly follows the DVBSubtitles */
+  delta = ((guint8 *) block + DVB_SUB_BLOCK_ALIGN (sizeof (DVBSubtitles))) -
+      (guint8 *) subs->rects;
+
+  subs->ref_count = 1;
+  subs->rects = (DVBSubtitleRect **) ((guint8 *) subs->rects + delta);
+  for (i = 0; i < subs->num_rects; i++) {
+    subs->rects[i] = rect = (DVBSubtitleRect *) ((guint8 *) subs->rects[i] +
+        delta);
+    rect->pict.palette = (guint32 *) ((guint8 *) rect->pict.palette + delta);
+    if (rect->pict.yuv_palette)
+      rect->pict.yuv_palette =
+          (guint32 *) ((guint8 *) rect->pict.yuv_palette + delta);
+    if (rect->pict.data)
+      rect->pict.data += delta;
+    /* Conversions belong to the original */
+    memset (rect->pixels, 0, sizeof (rect->pixels));
+  }
+
+  return subs;
+}
+
+/**
+ * dvb_sub_set_contiguous_output:
+ * @dvb_sub: a #DvbSub
+ * @contiguous: whether to output each display set as a single block
+ *
+ * Makes @dvb_sub hand out every #DVBSubtitles as one memory block that also
+ * holds all rects, palettes and pixel data, instead of sharing them with
+ * the decoder. This costs a copy of the pixel data per display set, but
+ * the block is freed in one go and can easily be copied elsewhere, see
+ * dvb_subtitles_get_block(). This is off by default.
+ */
+void
+dvb_sub_set_contiguous_output (DvbSub * dvb_sub, gboolean contiguous)
+{
+  DvbSubPrivate *priv;
+
+  g_return_if_fail (dvb_sub != NULL);
+  g_return_if_fail (DVB_IS_SUB (dvb_sub));
+
+  priv = (DvbSubPrivate *) dvb_sub->private_data;
+
+  priv->contiguous_output = contiguous;
+}
+
+/**
+ * dvb_sub_set_yuv_palette:
+ * @dvb_sub: a #DvbSub
+ * @enable: whether to output YUV palettes
+ * @matrix: the colour matrix of the video the subtitles go onto
+ *
+ * Makes @dvb_sub set the yuv_palette of each #DVBSubtitlePicture, besides
+ * the ARGB palette. It holds the CLUT entries in the Y, Cb, Cr form they are
+ * coded in, so that subtitles can be blended onto YUV video without
+ * converting them to RGB and back. Subtitles are coded for BT.601, so for
+ * BT.709 video the entries are converted, once per palette. This is off by
+ * default.
+ */
+void
+dvb_sub_set_yuv_palette (DvbSub * dvb_sub, gboolean enable,
+    DVBSubtitleColorMatrix matrix)
+{
+  DvbSubPrivate *priv;
+  DVBSubCLUT *clut;
+
+  g_return_if_fail (dvb_sub != NULL);
+  g_return_if_fail (DVB_IS_SUB (dvb_sub));
+  g_return_if_fail (matrix == DVB_SUBTITLE_COLOR_MATRIX_BT601
+      || matrix == DVB_SUBTITLE_COLOR_MATRIX_BT709);
+
+  priv = (DvbSubPrivate *) dvb_sub->private_data;
+
+  priv->yuv_palette = enable;
+  if (priv->color_matrix != matrix) {
+    /* Subtitles already handed out keep their palettes */
+    priv->color_matrix = matrix;
+    for (clut = priv->clut_list; clut; clut = clut->next)
+      release_palettes (clut->yuv_palettes);
+    release_palettes (priv->default_yuv_palettes);
+  }
+}
+
+/**
+ * dvb_sub_set_trim_transparent:
+ * @dvb_sub: a #DvbSub
+ * @trim: whether to trim the fully transparent borders of rects
+ *
+ * Makes @dvb_sub shrink each #DVBSubtitleRect to the smallest rectangle
+ * holding all the pixels of its region that aren't fully transparent, and
+ * leave out regions that are transparent altogether. Broadcasters often
+ * send regions much larger than the text in them, which then costs less to
+ * blend or upload. The #DVBSubtitlePicture data then points into the middle
+ * of the region, keeping its rowstride. This is off by default.
+ */
+void
+dvb_sub_set_trim_transparent (DvbSub * dvb_sub, gboolean trim)
+{
+  DvbSubPrivate *priv;
+
+  g_return_if_fail (dvb_sub != NULL);
+  g_return_if_fail (DVB_IS_SUB (dvb_sub));
+
+  priv = (DvbSubPrivate *) dvb_sub->private_data;
+
+  priv->trim_transparent = trim;
+}
+
+/**
+ * dvb_sub_set_allocator:
+ * @dvb_sub: a #DvbSub
+ * @allocator: the allocator to use, or %NULL for the default one
+ * @user_data: a user_data argument for the allocator functions
+ *
+ * Makes @dvb_sub decode regions directly into memory provided by the
+ * application, such as upload staging buffers or shared memory, and pads
+ * their rows to the alignment given in @allocator. The #DVBSubtitlePicture
+ * data handed out to the new_data callback then points into this memory.
+ * The contents of @allocator are copied.
+ *
+ * Setting an allocator discards the current decoding state, so this is
+ * best done before feeding any data.
+ */
+void
+dvb_sub_set_allocator (DvbSub * dvb_sub, const DvbSubAllocator * allocator,
+    gpointer user_data)
+{
+  DvbSubPrivate *priv;
+
+  g_return_if_fail (dvb_sub != NULL);
+  g_return_if_fail (DVB_IS_SUB (dvb_sub));
+  g_return_if_fail (allocator == NULL || (allocator->alloc == NULL) ==
+      (allocator->free == NULL));
+  g_return_if_fail (allocator == NULL ||
+      (allocator->rowstride_align & (allocator->rowstride_align - 1)) == 0);
+
+  priv = (DvbSubPrivate *) dvb_sub->private_data;
+
+  delete_state (dvb_sub);
+
+  if (allocator)
+    priv->allocator = *allocator;
+  else
+    memset (&priv->allocator, 0, sizeof (priv->allocator));
+  priv->allocator_data = user_data;
+}
+
+/**
+ * dvb_sub_set_page_ids:
+ * @dvb_sub: a #DvbSub
+ * @composition_page_id: the page to decode, or -1 to decode all pages
+ * @ancillary_page_id: the ancillary page with data shared between the
+ *   services of the stream, or -1 if there is none
+ *
+ * Selects the subtitling service to decode from a stream that carries
+ * several, e.g different languages on the same PID. The page ids of a service
+ * are signalled in the subtitling_descriptor of the PMT. Segments of all other
+ * pages are then skipped by their length without being parsed or decoded.
+ *
+ * Changing the selected pages discards the decoding state of the previous
+ * ones. By default all pages are decoded.
+ */
+void
+dvb_sub_set_page_ids (DvbSub * dvb_sub, gint composition_page_id,
+    gint ancillary_page_id)
+{
+  DvbSubPrivate *priv;
+
+  g_return_if_fail (dvb_sub != NULL);
+  g_return_if_fail (DVB_IS_SUB (dvb_sub));
+  g_return_if_fail (composition_page_id <= G_MAXUINT16);
+  g_return_if_fail (ancillary_page_id <= G_MAXUINT16);
+
+  priv = (DvbSubPrivate *) dvb_sub->private_data;
+
+  if (composition_page_id < 0)
+    ancillary_page_id = -1;
+
+  if (priv->composition_page_id == composition_page_id &&
+      priv->ancillary_page_id == ancillary_page_id)
+    return;
+
+  priv->composition_page_id = composition_page_id;
+  priv->ancillary_page_id = ancillary_page_id;
+  delete_state (dvb_sub);
+}
+
+/**
+ * dvb_sub_set_buffer_pool_limit:
+ * @dvb_sub: a #DvbSub
+ * @max_bytes: the maximum number of bytes of unused pixel buffers to keep
+ *
+ * Sets how much memory @dvb_sub may keep in unused region pixel buffers for
+ * reuse by later regions and display sets, instead of freeing them. Buffers
+ * are pooled by power of two size classes. A limit of 0 disables pooling.
+ * The default is 4 MiB.
+ */
+void
+dvb_sub_set_buffer_pool_limit (DvbSub * dvb_sub, gsize max_bytes)
+{
+  DvbSubPrivate *priv;
+
+  g_return_if_fail (dvb_sub != NULL);
+  g_return_if_fail (DVB_IS_SUB (dvb_sub));
+
+  priv = (DvbSubPrivate *) dvb_sub->private_data;
+
+  dvb_buffer_pool_set_limit (&priv->buffer_pool, max_bytes);
 }
 
 /**
@@ -1565,7 +2856,8 @@ dvb_sub_new (void)
  * should be fed continously until all is consumed.
  *
  * Return value: a negative value on errors, -4 if simply not enough data for the PES packet;
- *               Amount of data consumed (length of handled PES packet on success)
+ *               Amount of data consumed (length of handled PES packet on success,
+ *               or the amount of garbage skipped if @data does not start with one)
  */
 gint
 dvb_sub_feed (DvbSub * dvb_sub, guint8 * data, gint len)
@@ -1587,9 +2879,15 @@ dvb_sub_feed (DvbSub * dvb_sub, guint8 * data, gint len)
   }
 
   if (data[0] != 0x00 || data[1] != 0x00 || data[2] != 0x01) {
+    gint skip = dvb_pes_find_start_code (data, len);
+
+    /* Without a start code, keep the last bytes that may begin one */
+    if (skip < 0)
+      skip = len - 3;
     dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_WARNING,
-        "Data fed to dvb_sub_feed is not a PES packet - does not start with a code_prefix of 0x000001");
-    return 1;                   // FIXME: Probably handle it? - we need to skip PES_packet_len from this elementary stream then and move on
+        "Data fed to dvb_sub_feed is not a PES packet - does not start with a code_prefix of 0x000001, skipping %d bytes to the next packet",
+        skip);
+    return skip;
   }
 
   if (data[3] != 0xBD) {
@@ -1630,14 +2928,8 @@ dvb_sub_feed (DvbSub * dvb_sub, guint8 * data, gint len)
 
   PES_packet_header_len = data[pos++];
 
-  if (pts_field_present) {
-    /* '001x', PTS[32..30], marker, PTS[29..15], marker, PTS[14..0], marker */
-    pts = ((guint64) (data[pos] & 0x0E)) << 29; /* PTS[32..30], ignore marker at rightmost bit */
-    pts |= ((guint64) (data[pos + 1])) << 22;   /* PTS[29..22], full byte */
-    pts |= ((guint64) (data[pos + 2] & 0xFE)) << 14;    /* PTS[21..15], ignore marker at rightmost bit */
-    pts |= ((guint64) (data[pos + 3])) << 7;    /* PTS[14.. 7], full byte */
-    pts |= ((guint64) (data[pos + 4] & 0xFE)) >> 1;     /* PTS[ 6.. 0], ignore marker at rightmost bit */
-  }
+  if (pts_field_present)
+    pts = dvb_pes_read_timestamp (data + pos);
 
   pos += PES_packet_header_len; /* FIXME: Currently including all header values with all but PTS ignored */
 
@@ -1649,6 +2941,67 @@ dvb_sub_feed (DvbSub * dvb_sub, guint8 * data, gint len)
   return pos;
 }
 
+static void
+_dvb_sub_ts_pes_func (guint64 pts, guint8 * data, gint len, gpointer user_data)
+{
+  dvb_sub_feed_with_pts (DVB_SUB (user_data), pts, data, len);
+}
+
+/**
+ * dvb_sub_feed_ts:
+ * @dvb_sub: a #DvbSub
+ * @pid: the PID of the subtitle stream to decode
+ * @data: MPEG transport stream data
+ * @len: Length of the data
+ *
+ * Feeds the DvbSub parser with MPEG transport stream data, e.g from a recorded
+ * .ts file or a DVR device. The transport stream packets of @pid are
+ * reassembled into PES packets in software, checking their continuity
+ * counters, and the PES packets are then parsed as with dvb_sub_feed().
+ * Packets of other PIDs are skipped. Changing @pid between calls discards
+ * any partially received PES packet.
+ *
+ * Only whole transport stream packets are consumed, so data left over after
+ * the last complete packet should be fed again together with the following
+ * data.
+ *
+ * Return value: Amount of data consumed
+ */
+gint
+dvb_sub_feed_ts (DvbSub * dvb_sub, guint16 pid, guint8 * data, gint len)
+{
+  DvbSubPrivate *priv;
+  DvbTsPacket packet;
+  guint8 *ts_packet;
+  gboolean resynced;
+  gint pos = 0;
+
+  g_return_val_if_fail (dvb_sub != NULL, -1);
+  g_return_val_if_fail (DVB_IS_SUB (dvb_sub), -1);
+  g_return_val_if_fail (data != NULL || len == 0, -1);
+
+  priv = (DvbSubPrivate *) dvb_sub->private_data;
+
+  if (priv->ts_pes.pid != pid) {
+    dvb_pes_assembler_reset (&priv->ts_pes);
+    priv->ts_pes.pid = pid;
+  }
+
+  for (;;) {
+    ts_packet = dvb_ts_next_packet (data, len, &pos, &resynced);
+    /* A PES packet can't be continued across the skipped data */
+    if (resynced)
+      dvb_pes_assembler_reset (&priv->ts_pes);
+    if (!ts_packet)
+      break;
+
+    if (dvb_ts_packet_parse (ts_packet, &packet) && packet.pid == pid)
+      dvb_pes_assembler_push (&priv->ts_pes, &packet);
+  }
+
+  return pos;
+}
+
 #define DVB_SUB_SEGMENT_PAGE_COMPOSITION 0x10
 #define DVB_SUB_SEGMENT_REGION_COMPOSITION 0x11
 #define DVB_SUB_SEGMENT_CLUT_DEFINITION 0x12
@@ -1677,11 +3030,17 @@ dvb_sub_feed (DvbSub * dvb_sub, guint8 * data, gint len)
 gint
 dvb_sub_feed_with_pts (DvbSub * dvb_sub, guint64 pts, guint8 * data, gint len)
 {
+  DvbSubPrivate *priv;
   unsigned int pos = 0;
   guint8 segment_type;
   guint16 segment_len;
   guint16 page_id;
 
+  g_return_val_if_fail (dvb_sub != NULL, -1);
+  g_return_val_if_fail (DVB_IS_SUB (dvb_sub), -1);
+
+  priv = (DvbSubPrivate *) dvb_sub->private_data;
+
   dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_DEBUG,
       "Inside dvb_sub_feed_with_pts with pts=%" G_GUINT64_FORMAT
       " and length %d", pts, len);
@@ -1728,6 +3087,18 @@ dvb_sub_feed_with_pts (DvbSub * dvb_sub, guint64 pts, guint8 * data, gint len)
           segment_len, len - pos);
       return -2;
     }
+
+    /* Segments of pages not selected with dvb_sub_set_page_ids() are
+     * skipped by their length without parsing anything */
+    if (priv->composition_page_id >= 0 &&
+        page_id != priv->composition_page_id &&
+        page_id != priv->ancillary_page_id) {
+      dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_DEBUG,
+          "Skipping segment type 0x%x of unselected page_id 0x%x",
+          segment_type, page_id);
+      goto next_segment;
+    }
+
     // TODO: Parse the segment per type
     switch (segment_type) {
       case DVB_SUB_SEGMENT_PAGE_COMPOSITION:
@@ -1766,6 +3137,7 @@ dvb_sub_feed_with_pts (DvbSub * dvb_sub, guint64 pts, guint8 * data, gint len)
         break;
     }
 
+  next_segment:
     pos += segment_len;
 
     if (pos == len) {
@@ -1784,8 +3156,20 @@ dvb_sub_feed_with_pts (DvbSub * dvb_sub, guint64 pts, guint8 * data, gint len)
 #include <unistd.h>
 #include <stdio.h>              /* perror, printf */
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <linux/dvb/dmx.h>
 
+/* Amount of a mapped file decoded before the pages behind are dropped again */
+#define DVB_SUB_DECODE_FILE_WINDOW (64 * 1024 * 1024)
+
+static void
+_dvb_sub_ensure_pes_buffer (DvbSubPrivate * priv)
+{
+  if (!priv->pes_buffer.data)
+    dvb_ring_buffer_init (&priv->pes_buffer, DVB_SUB_PES_BUFFER_SIZE);
+}
+
 /**
  * dvb_sub_open_pid:
  * @dvb_sub: a #DvbSub
@@ -1825,6 +3209,8 @@ dvb_sub_open_pid (DvbSub * dvb_sub, guint16 pid, const gchar * adapter)
   if (priv->fd >= 0)            /* a file is already open, close it first */
     dvb_sub_close_pid (dvb_sub);
 
+  _dvb_sub_ensure_pes_buffer (priv);
+
   priv->fd = TEMP_FAILURE_RETRY (open (adapter, O_RDONLY | O_NONBLOCK));        /* FIXME: allow other hardware demuxers and adapters */
   if (priv->fd < 0) {
     perror (adapter);
@@ -1874,9 +3260,64 @@ dvb_sub_close_pid (DvbSub * dvb_sub)
 
   close (priv->fd);
   priv->fd = -1;
+  dvb_ring_buffer_clear (&priv->pes_buffer);
   delete_state (dvb_sub);
 }
 
+/**
+ * dvb_sub_get_fd:
+ * @dvb_sub: a #DvbSub
+ *
+ * Gets the PID related file descriptor previously opened by dvb_sub_open_pid().
+ *
+ * Return value: the file descriptor, -1 if no PID is open
+ */
+int
+dvb_sub_get_fd (DvbSub * dvb_sub)
+{
+  g_return_val_if_fail (dvb_sub != NULL, -1);
+  g_return_val_if_fail (DVB_IS_SUB (dvb_sub), -1);
+
+  return ((DvbSubPrivate *) dvb_sub->private_data)->fd;
+}
+
+/* Feeds all complete PES packets accumulated in pes_buffer to the parser.
+ * Each packet is handed over in place, straight from the ring storage */
+static void
+_dvb_sub_feed_pes_buffer (DvbSub * dvb_sub)
+{
+  DvbSubPrivate *priv = (DvbSubPrivate *) dvb_sub->private_data;
+  DvbRingBuffer *ring = &priv->pes_buffer;
+  guint8 *data;
+  gsize packet_len, avail;
+  gint skip;
+
+  while ((data = dvb_ring_buffer_peek (ring, 6))) {
+    if (data[0] != 0x00 || data[1] != 0x00 || data[2] != 0x01) {
+      /* Not at a packet_start_code_prefix, skip to the next one */
+      avail = MIN (dvb_ring_buffer_length (ring), DVB_PES_PACKET_MAX_SIZE);
+      data = dvb_ring_buffer_peek (ring, avail);
+      skip = dvb_pes_find_start_code (data, avail);
+      if (skip < 0)
+        skip = avail - 3;
+      dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_WARNING,
+          "Lost PES sync, skipping %d bytes", skip);
+      dvb_ring_buffer_consume (ring, skip);
+      continue;
+    }
+
+    packet_len = 6 + GST_READ_UINT16_BE (data + 4);
+    data = dvb_ring_buffer_peek (ring, packet_len);
+    if (!data)
+      break;                    /* wait for the rest of the packet */
+
+    /* The packet is framed by its PES_packet_length already, so it is
+     * consumed as a whole regardless of how the parser fared with it */
+    dvb_sub_feed (dvb_sub, data, packet_len);
+    dvb_ring_buffer_consume (ring, packet_len);
+  }
+}
+
 /**
  * dvb_sub_read_data:
  * @dvb_sub: a #DvbSub
@@ -1888,10 +3329,11 @@ void
 dvb_sub_read_data (DvbSub * dvb_sub)
 {
   DvbSubPrivate *priv;
-  GString *data;                /* FIXME: Probably don't use GString in the long run? */
-  gchar buf[4096];
+  DvbRingBuffer *ring;
+  guint8 *buf;
+  gsize space;
   ssize_t len_read;
-  int ret;
+  gboolean drained = FALSE;
 
   g_return_if_fail (dvb_sub != NULL);
   g_return_if_fail (DVB_IS_SUB (dvb_sub));
@@ -1900,34 +3342,215 @@ dvb_sub_read_data (DvbSub * dvb_sub)
 
   g_return_if_fail (priv->fd >= 0);
 
-  while ((len_read = read (priv->fd, buf, 4096))) {
-    if (len_read < 0) {
-      if (errno != EAGAIN)
-        g_warning
-            ("Error during demux file descriptor read. Code: %d, message: %s",
-            errno, strerror (errno));
-      /* FIXME: What should we actually do here? */
-      break;
+  ring = &priv->pes_buffer;
+
+  /* Read straight into the ring until the file descriptor is drained. If the
+   * ring fills up first (a backlog after a stall), parse what we have to make
+   * room and continue reading */
+  while (!drained) {
+    while ((buf = dvb_ring_buffer_write_ptr (ring, &space)), space > 0) {
+      len_read = read (priv->fd, buf, space);
+      if (len_read <= 0) {
+        if (len_read < 0 && errno == EINTR)
+          continue;
+        if (len_read < 0 && errno != EAGAIN)
+          g_warning
+              ("Error during demux file descriptor read. Code: %d, message: %s",
+              errno, strerror (errno));
+        /* FIXME: What should we actually do here? */
+        drained = TRUE;
+        break;
+      }
+
+      dvb_ring_buffer_commit (ring, len_read);
     }
 
-    g_string_append_len (priv->pes_buffer, buf, len_read);
+    dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_DEBUG,
+        "read_data called by API user, feeding %" G_GSIZE_FORMAT
+        " bytes into DVB subtitle parser", dvb_ring_buffer_length (ring));
+
+    _dvb_sub_feed_pes_buffer (dvb_sub);
   }
+}
 
-  dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_DEBUG,
-      "read_data called by API user, feeding %" G_GSIZE_FORMAT
-      " bytes into DVB subtitle parser", priv->pes_buffer->len);
-
-  do {
-    ret =
-        dvb_sub_feed (dvb_sub, (guint8 *) (priv->pes_buffer->str),
-        priv->pes_buffer->len);
-    if (ret > 0)
-      /* FIXME: MIN() is a temporary workaround because dvb_sub_feed(_with_pts) returned in a rare circumstance
-       * a number bigger than the length passed to it. That needs to be fixed instead, but it was a rare
-       * occurrence with not enough debug enabled at the time to find the problem quickly enough for next release,
-       * so just at least don't end up in an infinite loop meanwhile. */
-      g_string_erase (priv->pes_buffer, 0, MIN (ret, priv->pes_buffer->len));
-  } while (ret > 0);
+/**
+ * dvb_sub_feed_stream:
+ * @dvb_sub: a #DvbSub
+ * @data: PES stream data
+ * @len: Length of the data
+ *
+ * Feeds the DvbSub parser with a chunk of a PES stream, as delivered by a
+ * demux file descriptor or read from a recorded PES file. Unlike with
+ * dvb_sub_feed(), the chunk boundaries do not need to match the PES packet
+ * boundaries - incomplete packets are buffered until the rest of them is fed.
+ * This is what dvb_sub_read_data() does with the data it reads, and is useful
+ * when the reading is done elsewhere, e.g by a #DvbSubReactor.
+ */
+void
+dvb_sub_feed_stream (DvbSub * dvb_sub, const guint8 * data, gint len)
+{
+  DvbSubPrivate *priv;
+  DvbRingBuffer *ring;
+  guint8 *buf;
+  gsize space;
+
+  g_return_if_fail (dvb_sub != NULL);
+  g_return_if_fail (DVB_IS_SUB (dvb_sub));
+  g_return_if_fail (data != NULL || len == 0);
+
+  priv = (DvbSubPrivate *) dvb_sub->private_data;
+  ring = &priv->pes_buffer;
+
+  _dvb_sub_ensure_pes_buffer (priv);
+
+  while (len > 0) {
+    buf = dvb_ring_buffer_write_ptr (ring, &space);
+    if (space == 0) {
+      /* Parse what we have to make room for the rest */
+      _dvb_sub_feed_pes_buffer (dvb_sub);
+      continue;
+    }
+    space = MIN (space, (gsize) len);
+    memcpy (buf, data, space);
+    dvb_ring_buffer_commit (ring, space);
+    data += space;
+    len -= space;
+  }
+
+  _dvb_sub_feed_pes_buffer (dvb_sub);
+}
+
+/* Feeds the complete PES packets in data to the parser in place, skipping any
+ * garbage between them. Returns the amount of data consumed, which excludes a
+ * trailing incomplete packet */
+static gsize
+_dvb_sub_feed_pes_data (DvbSub * dvb_sub, guint8 * data, gsize len)
+{
+  gsize pos = 0, packet_len;
+  gint skip, avail;
+
+  while (len - pos >= 6) {
+    if (data[pos] != 0x00 || data[pos + 1] != 0x00 || data[pos + 2] != 0x01) {
+      avail = MIN (len - pos, G_MAXINT);
+      skip = dvb_pes_find_start_code (data + pos, avail);
+      if (skip < 0)
+        skip = avail - 3;
+      dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_WARNING,
+          "Lost PES sync, skipping %d bytes", skip);
+      pos += skip;
+      continue;
+    }
+
+    packet_len = 6 + GST_READ_UINT16_BE (data + pos + 4);
+    if (packet_len > len - pos)
+      break;
+
+    dvb_sub_feed (dvb_sub, data + pos, packet_len);
+    pos += packet_len;
+  }
+
+  return pos;
+}
+
+/**
+ * dvb_sub_decode_file:
+ * @dvb_sub: a #DvbSub
+ * @filename: a recorded PES stream or MPEG transport stream file
+ * @pid: the PID of the subtitle stream in a transport stream file, ignored for
+ *   PES files
+ *
+ * Decodes a whole recorded file. The file is memory mapped and its packets are
+ * parsed in place as the pages come in, so decoding starts right away and
+ * the file is never copied. Pages already decoded are dropped again as
+ * decoding proceeds, so even very large files use little memory.
+ *
+ * Transport stream files are recognized by their sync bytes and fed as with
+ * dvb_sub_feed_ts(), other files are taken to be a PES stream.
+ *
+ * Return value: 0 on success, -1 on error
+ */
+gint
+dvb_sub_decode_file (DvbSub * dvb_sub, const gchar * filename, guint16 pid)
+{
+  struct stat st;
+  guint8 *data;
+  gsize size, pos = 0, end, consumed, released = 0, release_to;
+  gsize page_mask = sysconf (_SC_PAGESIZE) - 1;
+  gboolean is_ts;
+  int fd;
+
+  g_return_val_if_fail (dvb_sub != NULL, -1);
+  g_return_val_if_fail (DVB_IS_SUB (dvb_sub), -1);
+  g_return_val_if_fail (filename != NULL, -1);
+
+  fd = TEMP_FAILURE_RETRY (open (filename, O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    perror (filename);
+    return -1;
+  }
+
+  if (fstat (fd, &st) != 0) {
+    perror (filename);
+    close (fd);
+    return -1;
+  }
+
+  size = st.st_size;
+  if (size == 0) {
+    close (fd);
+    return 0;
+  }
+
+  data = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);                   /* the mapping keeps the file referenced */
+  if (data == MAP_FAILED) {
+    perror ("mmap");
+    return -1;
+  }
+
+  madvise (data, size, MADV_SEQUENTIAL);
+
+  is_ts = dvb_ts_sync (data, MIN (size, 3 * DVB_TS_PACKET_SIZE)) == 0;
+  if (is_ts && pid == 0) {
+    g_warning ("'%s' is a transport stream, but no subtitle PID was given",
+        filename);
+    munmap (data, size);
+    return -1;
+  }
+
+  dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_INFO,
+      "Decoding %" G_GSIZE_FORMAT " bytes of %s from '%s'", size,
+      is_ts ? "transport stream" : "PES stream", filename);
+
+  while (pos < size) {
+    end = MIN (size, pos + DVB_SUB_DECODE_FILE_WINDOW);
+
+    if (is_ts)
+      consumed = dvb_sub_feed_ts (dvb_sub, pid, data + pos, end - pos);
+    else
+      consumed = _dvb_sub_feed_pes_data (dvb_sub, data + pos, end - pos);
+
+    /* Only a truncated packet at the end of the file is left unconsumed,
+     * anything else fits within a window */
+    if (consumed == 0)
+      break;
+    pos += consumed;
+
+    release_to = pos & ~page_mask;
+    if (release_to > released) {
+      madvise (data + released, release_to - released, MADV_DONTNEED);
+      released = release_to;
+    }
+  }
+
+  if (pos < size)
+    dvb_log (DVB_LOG_PACKET, G_LOG_LEVEL_WARNING,
+        "Ignoring %" G_GSIZE_FORMAT " bytes of a truncated packet at the end",
+        size - pos);
+
+  munmap (data, size);
+
+  return 0;
 }
 
 /**
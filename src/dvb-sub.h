@@ -62,9 +62,14 @@ struct _DvbSub
  *   on the depth of the subpicture; each palette item is in ARGB form, 8-bits per channel.
  * @palette_bits_count: the amount of bits used in indeces into @palette in @data.
  * @rowstride: the number of bytes between the start of a row and the start of the next row.
+ * @yuv_palette: the same palette with each item in AYUV form, 8-bits per channel
+ *   like @palette, or %NULL unless enabled with dvb_sub_set_yuv_palette().
  *
  * A structure representing the contents of a subtitle rectangle.
  *
+ * @data and @palette are shared with the decoder and other #DVBSubtitles
+ * without copying, and must not be modified.
+ *
  * FIXME: Expose the depth of the palette, and perhaps also the height in this struct.
  */
 typedef struct DVBSubtitlePicture {
@@ -72,8 +77,60 @@ typedef struct DVBSubtitlePicture {
 	guint32 *palette;
 	guint8 palette_bits_count;
 	int rowstride;
+	guint32 *yuv_palette;
 } DVBSubtitlePicture;
 
+/**
+ * DVBSubtitleRectFlags:
+ * @DVB_SUBTITLE_RECT_ADDED: the region was not part of the previous display set
+ * @DVB_SUBTITLE_RECT_MOVED: the region was shown at another position in the
+ *   previous display set
+ *
+ * Flags describing how a #DVBSubtitleRect changed since the previous
+ * display set passed to the new_data callback.
+ */
+typedef enum {
+	DVB_SUBTITLE_RECT_ADDED = 1 << 0,
+	DVB_SUBTITLE_RECT_MOVED = 1 << 1
+} DVBSubtitleRectFlags;
+
+/**
+ * DVBSubtitlePixelFormat:
+ * @DVB_SUBTITLE_PIXEL_FORMAT_ARGB32: bytes in the order alpha, red, green, blue
+ * @DVB_SUBTITLE_PIXEL_FORMAT_RGBA32: bytes in the order red, green, blue, alpha
+ * @DVB_SUBTITLE_PIXEL_FORMAT_BGRA32: bytes in the order blue, green, red, alpha
+ * @DVB_SUBTITLE_PIXEL_FORMAT_ARGB32_PREMULTIPLIED: as ARGB32, with the colour
+ *   multiplied by alpha
+ * @DVB_SUBTITLE_PIXEL_FORMAT_RGBA32_PREMULTIPLIED: as RGBA32, premultiplied
+ * @DVB_SUBTITLE_PIXEL_FORMAT_BGRA32_PREMULTIPLIED: as BGRA32, premultiplied
+ * @DVB_SUBTITLE_PIXEL_FORMAT_AYUV: bytes in the order alpha, Y, Cb, Cr
+ *
+ * Pixel formats for dvb_subtitle_rect_get_pixels(), named by the order of
+ * their bytes in memory like GStreamer video formats. The native endian
+ * 0xAARRGGBB pixels of Qt and cairo are BGRA32 on little endian machines.
+ */
+typedef enum {
+	DVB_SUBTITLE_PIXEL_FORMAT_ARGB32,
+	DVB_SUBTITLE_PIXEL_FORMAT_RGBA32,
+	DVB_SUBTITLE_PIXEL_FORMAT_BGRA32,
+	DVB_SUBTITLE_PIXEL_FORMAT_ARGB32_PREMULTIPLIED,
+	DVB_SUBTITLE_PIXEL_FORMAT_RGBA32_PREMULTIPLIED,
+	DVB_SUBTITLE_PIXEL_FORMAT_BGRA32_PREMULTIPLIED,
+	DVB_SUBTITLE_PIXEL_FORMAT_AYUV
+} DVBSubtitlePixelFormat;
+
+/**
+ * DVBSubtitleColorMatrix:
+ * @DVB_SUBTITLE_COLOR_MATRIX_BT601: ITU-R BT.601, as used by SD video
+ * @DVB_SUBTITLE_COLOR_MATRIX_BT709: ITU-R BT.709, as used by HD video
+ *
+ * The colour matrix for the YUV palettes of dvb_sub_set_yuv_palette().
+ */
+typedef enum {
+	DVB_SUBTITLE_COLOR_MATRIX_BT601,
+	DVB_SUBTITLE_COLOR_MATRIX_BT709
+} DVBSubtitleColorMatrix;
+
 /**
  * DVBSubtitleRect:
  * @x: x coordinate of top left corner
@@ -81,8 +138,19 @@ typedef struct DVBSubtitlePicture {
  * @w: the width of this subpicture rectangle
  * @h: the height of this subpicture rectangle
  * @pict: the content of this subpicture rectangle
+ * @region_id: the id of the region shown in this rectangle, which identifies
+ *   it across display sets
+ * @dirty_x: x coordinate of the changed area, relative to @x
+ * @dirty_y: y coordinate of the changed area, relative to @y
+ * @dirty_w: the width of the area of @pict that changed since the previous
+ *   display set, 0 if nothing changed
+ * @dirty_h: the height of the changed area
+ * @flags: #DVBSubtitleRectFlags
  *
  * A structure representing one subtitle objects position, dimension and content.
+ *
+ * Renderers that keep the previous display set can update just the changed
+ * area of each rectangle. Added rectangles are entirely changed.
  */
 typedef struct DVBSubtitleRect {
 	int x;
@@ -91,6 +159,16 @@ typedef struct DVBSubtitleRect {
 	int h;
 
 	DVBSubtitlePicture pict;
+
+	int region_id;
+	int dirty_x;
+	int dirty_y;
+	int dirty_w;
+	int dirty_h;
+	guint flags;
+	/*< private >*/
+	guint8 *buffer;          /* start of the shared region buffer */
+	guint32 *pixels[7];      /* converted to each DVBSubtitlePixelFormat */
 } DVBSubtitleRect;
 
 /**
@@ -124,40 +202,110 @@ typedef struct DVBSubtitleWindow {
  * DVBSubtitles:
  * @num_rects: the number of #DVBSubtitleRect in @rects
  * @rects: dynamic array of #DVBSubtitleRect
+ * @display_def: the display definition in effect
+ * @removed_regions: bitmask of the ids of the regions shown in the previous
+ *   display set but not anymore in this one; test it with
+ *   DVB_SUBTITLES_REGION_REMOVED()
  *
- * A structure representing a set of subtitle objects.
+ * A structure representing a set of subtitle objects. It is reference
+ * counted with dvb_subtitles_ref() and dvb_subtitles_unref(). With
+ * dvb_sub_set_contiguous_output() it is a single memory block, see
+ * dvb_subtitles_get_block().
  */
 typedef struct DVBSubtitles {
 	unsigned int num_rects;
 	DVBSubtitleRect **rects;
 	DVBSubtitleWindow display_def;
+	guint32 removed_regions[8];
+	/*< private >*/
+	volatile gint ref_count;
+	gsize block_size;        /* non-zero if contiguous */
 } DVBSubtitles;
 
+/**
+ * DVB_SUBTITLES_REGION_REMOVED:
+ * @subs: a #DVBSubtitles
+ * @region_id: a region id
+ *
+ * Checks whether the region @region_id was shown in the previous display
+ * set, but isn't anymore in @subs.
+ */
+#define DVB_SUBTITLES_REGION_REMOVED(subs, region_id) \
+	(((subs)->removed_regions[(region_id) / 32] >> ((region_id) % 32)) & 1)
+
 /**
  * DvbSubCallbacks:
  * @new_data: called when new subpicture data is available for display. @dvb_sub
  *    is the #DvbSub instance this callback originates from; @subs is the set of
  *    subtitle objects that should be display for no more than @page_time_out
  *    seconds at @pts; @user_data is the same user_data as was passed through
- *    dvb_sub_set_callbacks();
+ *    dvb_sub_set_callbacks(); @subs is only valid during the callback, unless
+ *    a reference is taken with dvb_subtitles_ref();
+ * @unchanged: called instead of @new_data when a display set has been
+ *    received that is identical to the one last passed to @new_data, as is the
+ *    case for the repeats at acquisition points. The subtitles last shown
+ *    should remain displayed for no more than @page_time_out seconds from @pts.
+ *    If this is %NULL, @new_data is called for every display set.
  *
  * A set of callbacks that can be installed on the #DvbSub with
  * dvb_sub_set_callbacks().
  */
 typedef struct {
 	void     (*new_data) (DvbSub *dvb_sub, guint64 pts, DVBSubtitles * subs, guint8 page_time_out, gpointer user_data);
+	void     (*unchanged) (DvbSub *dvb_sub, guint64 pts, guint8 page_time_out, gpointer user_data);
 	/*< private >*/
-	gpointer _dvb_sub_reserved[3];
+	gpointer _dvb_sub_reserved[2];
 } DvbSubCallbacks;
 
+/**
+ * DvbSubAllocator:
+ * @alloc: allocates a block of @size bytes for region pixel data, with
+ *    @user_data as passed to dvb_sub_set_allocator(). May return %NULL,
+ *    in which case the library uses its own memory for that region. The
+ *    pixel data is placed within the block after a small header.
+ * @free: frees a block returned by @alloc, once neither the decoder nor
+ *    any #DVBSubtitles uses it anymore. This can happen from whichever
+ *    thread drops the last reference, and after the #DvbSub is finalized.
+ * @rowstride_align: the alignment of the start of the pixel data and of
+ *    its rowstride in bytes, a power of two; 0 for no padding. This is
+ *    honoured even if @alloc and @free are %NULL.
+ *
+ * An allocator for the pixel data of subtitle regions, installed with
+ * dvb_sub_set_allocator(). @alloc and @free must either both be set or
+ * both be %NULL.
+ */
+typedef struct {
+	gpointer (*alloc) (gsize size, gpointer user_data);
+	void     (*free)  (gpointer mem, gpointer user_data);
+	guint    rowstride_align;
+	/*< private >*/
+	gpointer _dvb_sub_reserved[2];
+} DvbSubAllocator;
+
 GType    dvb_sub_get_type      (void) G_GNUC_CONST;
 DvbSub  *dvb_sub_new           (void);
 gint     dvb_sub_feed          (DvbSub *dvb_sub, guint8 *data, gint len);
 gint     dvb_sub_feed_with_pts (DvbSub *dvb_sub, guint64 pts, guint8 *data, gint len);
+gint     dvb_sub_feed_ts       (DvbSub *dvb_sub, guint16 pid, guint8 *data, gint len);
 int      dvb_sub_open_pid      (DvbSub *dvb_sub, guint16 pid, const gchar *adapter);
 void     dvb_sub_close_pid     (DvbSub *dvb_sub);
+int      dvb_sub_get_fd        (DvbSub *dvb_sub);
 void     dvb_sub_read_data     (DvbSub *dvb_sub);
+void     dvb_sub_feed_stream   (DvbSub *dvb_sub, const guint8 *data, gint len);
+gint     dvb_sub_decode_file   (DvbSub *dvb_sub, const gchar *filename, guint16 pid);
 void     dvb_sub_set_callbacks (DvbSub *dvb_sub, DvbSubCallbacks *callbacks, gpointer user_data);
+void     dvb_sub_set_allocator (DvbSub *dvb_sub, const DvbSubAllocator *allocator, gpointer user_data);
+void     dvb_sub_set_contiguous_output (DvbSub *dvb_sub, gboolean contiguous);
+void     dvb_sub_set_trim_transparent (DvbSub *dvb_sub, gboolean trim);
+void     dvb_sub_set_yuv_palette (DvbSub *dvb_sub, gboolean enable, DVBSubtitleColorMatrix matrix);
+void     dvb_sub_set_page_ids  (DvbSub *dvb_sub, gint composition_page_id, gint ancillary_page_id);
+void     dvb_sub_set_buffer_pool_limit (DvbSub *dvb_sub, gsize max_bytes);
+
+DVBSubtitles *dvb_subtitles_ref       (DVBSubtitles *subs);
+void          dvb_subtitles_unref     (DVBSubtitles *subs);
+gconstpointer dvb_subtitles_get_block (DVBSubtitles *subs, gsize *size);
+const guint32 *dvb_subtitle_rect_get_pixels (DVBSubtitleRect *rect, DVBSubtitlePixelFormat format);
+DVBSubtitles *dvb_subtitles_rebase    (gpointer block);
 
 G_END_DECLS
 
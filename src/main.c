@@ -17,8 +17,10 @@
 #include <dvb-sub.h>
 
 static gchar **parse_filenames = NULL;
+static gint parse_pid = 0;
 
 static GOptionEntry entries[] = {
+	{ "pid", 'p', 0, G_OPTION_ARG_INT, &parse_pid, "PID of the subtitle stream, for transport stream files", "PID" },
 	{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &parse_filenames, "File to source for parsing test", NULL },
 	{ NULL, }
 };
@@ -30,8 +32,7 @@ main (int argc, char *argv[])
 
 	GError *error = NULL;
 	GOptionContext *context;
-	gchar *file_buf;
-	gsize file_len;
+	int ret = 0;
 
 	g_type_init ();
 
@@ -51,32 +52,40 @@ main (int argc, char *argv[])
 
 	sub_parser = DVB_SUB (dvb_sub_new ());
 
-	if (!g_file_get_contents (parse_filenames[0], &file_buf, &file_len, NULL)) {
-		g_error ("Read of file '%s' contents failed!", parse_filenames[0]);
-		return -1;
-	}
-
 //#define DVBSUB_TEST_FROM_GST_DUMP
 #ifdef DVBSUB_TEST_FROM_GST_DUMP
 	{
+		gchar *file_buf, *file_pos;
+		gsize file_len;
 		int parsed_len;
+
+		if (!g_file_get_contents (parse_filenames[0], &file_buf, &file_len, NULL)) {
+			g_error ("Read of file '%s' contents failed!", parse_filenames[0]);
+			return -1;
+		}
+
+		file_pos = file_buf;
 		while (file_len > 0) {
-			parsed_len = dvb_sub_feed_with_pts (sub_parser, 0, (guchar*)file_buf, file_len);
+			parsed_len = dvb_sub_feed_with_pts (sub_parser, 0, (guchar*)file_pos, file_len);
 			if (parsed_len < 0) {
 				g_warning ("dvb_sub_feed_with_pts returned with an error. Code = %d", parsed_len);
 				break;
 			}
 			file_len -= parsed_len;
-			file_buf += parsed_len;
+			file_pos += parsed_len;
 		}
+
+		g_free (file_buf);
 	}
 #else
-	dvb_sub_feed (sub_parser, (guchar*)file_buf, file_len);
+	if (dvb_sub_decode_file (sub_parser, parse_filenames[0], parse_pid) < 0) {
+		g_warning ("Decoding file '%s' failed!", parse_filenames[0]);
+		ret = -1;
+	}
 #endif
 
-	g_free (file_buf);
 	g_object_unref (sub_parser);
 	g_option_context_free (context);
 
-	return 0;
+	return ret;
 }